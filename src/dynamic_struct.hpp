@@ -3,9 +3,11 @@
 #pragma once
 
 #include "utils.hpp"
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <typeindex>
 #include <vector>
@@ -106,18 +108,21 @@ public:
             ret->refcount.store(1, std::memory_order_relaxed);
             ret->item_count = desc.size();
 
-            size_t offs = 0;
+            // align the start of every item, and the size to the largest
+            // alignment, so DynamicTable can put rows after each other
+            size_t offs = 0, max_al = 1;
             for (size_t i = 0; i < desc.size(); ++i)
             {
+                auto al = ALIGN_OF[desc[i].first];
+                offs = (offs + al - 1) / al * al;
+                max_al = std::max(max_al, al);
+
                 ret->items[i].idx = desc[i].first;
                 ret->items[i].size = desc[i].second;
                 ret->items[i].offset = offs;
-
                 offs += desc[i].second;
-                auto al = ALIGN_OF[desc[i].first];
-                offs = (offs + al - 1) / al * al;
             }
-            ret->size = offs;
+            ret->size = (offs + max_al - 1) / max_al * max_al;
 
             return ret;
         }
@@ -135,21 +140,38 @@ public:
                 { new (&x) std::remove_reference_t<decltype(x)>; });
     }
 
+    DynamicStruct(const DynamicStruct& o) : type{o.type}
+    {
+        if (!type) return;
+        data.reset(new char[type->size]);
+        // fixed size buffers (like FixStringTag) are larger than their type
+        memcpy(data.get(), o.data.get(), type->size);
+        for (size_t i = 0; i < type->item_count; ++i)
+            o.Visit(i, [&](const auto& x, size_t)
+            {
+                using T = std::remove_cv_t<std::remove_reference_t<decltype(x)>>;
+                if (!std::is_trivially_copyable<T>::value)
+                    new (&data[type->items[i].offset]) T(x);
+            });
+    }
+    DynamicStruct& operator=(const DynamicStruct& o)
+    {
+        if (this != &o) *this = DynamicStruct{o};
+        return *this;
+    }
+
     DynamicStruct(DynamicStruct&& o) : type{o.type}, data{std::move(o.data)}
     { o.type = nullptr; o.data = nullptr; }
     DynamicStruct& operator=(DynamicStruct&& o)
     {
-        if (this != &o)
-        {
-            type = o.type;
-            data = std::move(o.data);
-            o.type = nullptr;
-            o.data = nullptr;
-        }
+        // o destroys our old members
+        std::swap(type, o.type);
+        std::swap(data, o.data);
         return *this;
     }
     ~DynamicStruct()
     {
+        if (!type) return; // moved from
         ForEach([](auto& x, size_t)
                 {
                     using T = std::remove_reference_t<decltype(x)>;
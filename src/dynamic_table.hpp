@@ -0,0 +1,348 @@
+#ifndef UUID_AB5DE44F_BED7_43F5_97EC_58C8B235F83B
+#define UUID_AB5DE44F_BED7_43F5_97EC_58C8B235F83B
+#pragma once
+
+#include "dynamic_struct.hpp"
+#include <iterator>
+
+namespace Neptools
+{
+
+// Rows of one DynamicStruct type in a single contiguous buffer, instead of a
+// separate allocation per struct. Rows are accessed through cheap Row
+// proxies with the same interface as DynamicStruct, columns through strided
+// typed ranges. Only columns with non-trivial types (like std::string) need
+// per-cell construction, copying and destruction, everything else is
+// memcpy'd a whole buffer at a time.
+template <typename... Args>
+class DynamicTable
+{
+    template <typename Ret, size_t I, typename Char, typename Fun,
+              typename... FunArgs>
+    static Ret VisitHlp(size_t, Char*, size_t, Fun&&, FunArgs&&...)
+    { abort(); }
+
+    template <typename Ret, size_t I, typename T, typename... TRest,
+              typename Char, typename Fun, typename... FunArgs>
+    static Ret VisitHlp(size_t idx, Char* ptr, size_t size, Fun&& fun,
+                        FunArgs&&... args)
+    {
+        using TT = std::conditional_t<std::is_const<Char>::value, const T, T>;
+        if (idx == I)
+            return fun(*reinterpret_cast<TT*>(ptr), size,
+                       std::forward<FunArgs>(args)...);
+        else
+            return VisitHlp<Ret, I+1, TRest...>(
+                idx, ptr, size, std::forward<Fun>(fun),
+                std::forward<FunArgs>(args)...);
+    }
+
+    template <typename T>
+    static constexpr bool IsTrivial()
+    {
+        return std::is_trivially_copyable<T>::value &&
+            std::is_trivially_destructible<T>::value;
+    }
+    static constexpr const bool TRIVIAL[] = { IsTrivial<Args>()... };
+
+public:
+    using Struct = DynamicStruct<Args...>;
+    using Type = typename Struct::Type;
+    using TypePtr = typename Struct::TypePtr;
+
+    template <bool Const>
+    class RowRef
+    {
+        using Char = std::conditional_t<Const, const char, char>;
+        template <typename T>
+        using Ref = std::conditional_t<Const, const T&, T&>;
+
+    public:
+        RowRef(const Type* type, Char* data) noexcept
+            : type{type}, data{data} {}
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        RowRef(const RowRef<false>& o) noexcept
+            : type{o.type}, data{o.data} {}
+
+        size_t GetSize() const noexcept { return type->item_count; }
+        size_t GetSize(size_t i) const
+        {
+            NEPTOOLS_ASSERT_MSG(i < GetSize(), "index out of range");
+            return type->items[i].size;
+        }
+        size_t GetTypeIndex(size_t i) const
+        {
+            NEPTOOLS_ASSERT_MSG(i < GetSize(), "index out of range");
+            return type->items[i].idx;
+        }
+
+        template <typename T>
+        bool Is(size_t i) const
+        { return GetTypeIndex(i) == Struct::template GetIndexFromType<T>(); }
+
+        template <typename T>
+        Ref<T> Get(size_t i) const
+        {
+            NEPTOOLS_ASSERT_MSG(Is<T>(i), "specified item is not T");
+            return *reinterpret_cast<std::remove_reference_t<Ref<T>>*>(
+                data + type->items[i].offset);
+        }
+
+        Char* GetData() const noexcept { return data; }
+
+        template <typename Ret = void, typename... FunArgs>
+        Ret Visit(size_t i, FunArgs&&... f) const
+        {
+            NEPTOOLS_ASSERT_MSG(i < GetSize(), "index out of range");
+            const auto& it = type->items[i];
+            return VisitHlp<Ret, 0, Args...>(
+                it.idx, data + it.offset, it.size, std::forward<FunArgs>(f)...);
+        }
+
+        template <typename... FunArgs>
+        void ForEach(FunArgs&&... f) const
+        {
+            for (size_t i = 0; i < type->item_count; ++i)
+                Visit(i, std::forward<FunArgs>(f)...);
+        }
+
+    private:
+        template <bool> friend class RowRef;
+        const Type* type;
+        Char* data;
+    };
+    using Row = RowRef<false>;
+    using ConstRow = RowRef<true>;
+
+    template <bool Const>
+    class RowIterator
+    {
+        using Char = std::conditional_t<Const, const char, char>;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = RowRef<Const>;
+        using reference = RowRef<Const>;
+        using pointer = void;
+        using difference_type = std::ptrdiff_t;
+
+        RowIterator(const Type* type, Char* data, size_t stride) noexcept
+            : type{type}, data{data}, stride{stride} {}
+
+        reference operator*() const noexcept { return {type, data}; }
+        RowIterator& operator++() noexcept { data += stride; return *this; }
+        RowIterator operator++(int) noexcept
+        { auto ret = *this; ++*this; return ret; }
+
+        bool operator==(const RowIterator& o) const noexcept
+        { return data == o.data; }
+        bool operator!=(const RowIterator& o) const noexcept
+        { return data != o.data; }
+
+    private:
+        const Type* type;
+        Char* data;
+        size_t stride;
+    };
+    using iterator = RowIterator<false>;
+    using const_iterator = RowIterator<true>;
+
+    // one column of every row
+    template <typename T, bool Const>
+    class ColumnRef
+    {
+        using Char = std::conditional_t<Const, const char, char>;
+        using Ref = std::conditional_t<Const, const T&, T&>;
+    public:
+        ColumnRef(Char* data, size_t stride, size_t count) noexcept
+            : data{data}, stride{stride}, count{count} {}
+
+        size_t size() const noexcept { return count; }
+        Ref operator[](size_t row) const noexcept
+        {
+            NEPTOOLS_ASSERT_MSG(row < count, "index out of range");
+            return *reinterpret_cast<std::remove_reference_t<Ref>*>(
+                data + row * stride);
+        }
+
+    private:
+        Char* data;
+        size_t stride, count;
+    };
+
+    DynamicTable() = default;
+    explicit DynamicTable(TypePtr type_, size_t rows = 0)
+        : type{std::move(type_)}, stride{type->size}
+    {
+        for (size_t i = 0; i < type->item_count; ++i)
+            if (!TRIVIAL[type->items[i].idx]) complex_items.push_back(i);
+        resize(rows);
+    }
+
+    DynamicTable(const DynamicTable& o)
+        : type{o.type}, stride{o.stride}, complex_items{o.complex_items}
+    {
+        if (o.rows == 0) return;
+        reserve(o.rows);
+        // fixed size buffers (like FixStringTag) are larger than their type
+        memcpy(data.get(), o.data.get(), o.rows * stride);
+        for (size_t r = 0; r < o.rows; ++r)
+            for (auto i : complex_items)
+                o[r].Visit(i, [&](const auto& x, size_t)
+                {
+                    using T = std::remove_cv_t<
+                        std::remove_reference_t<decltype(x)>>;
+                    new (GetCell(r, i)) T(x);
+                });
+        rows = o.rows;
+    }
+    DynamicTable& operator=(const DynamicTable& o)
+    {
+        if (this != &o) *this = DynamicTable{o};
+        return *this;
+    }
+
+    DynamicTable(DynamicTable&& o) noexcept { swap(o); }
+    DynamicTable& operator=(DynamicTable&& o) noexcept
+    {
+        // o destroys our old rows
+        swap(o);
+        return *this;
+    }
+    ~DynamicTable() { clear(); }
+
+    void swap(DynamicTable& o) noexcept
+    {
+        std::swap(type, o.type);
+        std::swap(stride, o.stride);
+        std::swap(complex_items, o.complex_items);
+        std::swap(data, o.data);
+        std::swap(rows, o.rows);
+        std::swap(cap, o.cap);
+    }
+
+    const TypePtr& GetRawType() const noexcept { return type; }
+    // bytes between rows
+    size_t GetStride() const noexcept { return stride; }
+
+    size_t size() const noexcept { return rows; }
+    size_t capacity() const noexcept { return cap; }
+    bool empty() const noexcept { return rows == 0; }
+
+    Row operator[](size_t i) noexcept
+    {
+        NEPTOOLS_ASSERT_MSG(i < rows, "index out of range");
+        return {type.get(), data.get() + i * stride};
+    }
+    ConstRow operator[](size_t i) const noexcept
+    {
+        NEPTOOLS_ASSERT_MSG(i < rows, "index out of range");
+        return {type.get(), data.get() + i * stride};
+    }
+    Row back() noexcept { return (*this)[rows-1]; }
+    ConstRow back() const noexcept { return (*this)[rows-1]; }
+
+    iterator begin() noexcept { return {type.get(), data.get(), stride}; }
+    iterator end() noexcept
+    { return {type.get(), data.get() + rows * stride, stride}; }
+    const_iterator begin() const noexcept
+    { return {type.get(), data.get(), stride}; }
+    const_iterator end() const noexcept
+    { return {type.get(), data.get() + rows * stride, stride}; }
+
+    template <typename T>
+    ColumnRef<T, false> GetColumn(size_t i)
+    {
+        NEPTOOLS_ASSERT_MSG(IsColumn<T>(i), "specified column is not T");
+        return {data.get() + type->items[i].offset, stride, rows};
+    }
+    template <typename T>
+    ColumnRef<T, true> GetColumn(size_t i) const
+    {
+        NEPTOOLS_ASSERT_MSG(IsColumn<T>(i), "specified column is not T");
+        return {data.get() + type->items[i].offset, stride, rows};
+    }
+
+    void reserve(size_t n)
+    {
+        if (n <= cap) return;
+        NEPTOOLS_ASSERT_MSG(type, "reserve on an untyped table");
+        std::unique_ptr<char[]> ndata{new char[n * stride]};
+        if (rows) memcpy(ndata.get(), data.get(), rows * stride);
+        for (size_t r = 0; r < rows; ++r)
+            for (auto i : complex_items)
+                (*this)[r].Visit(i, [&](auto& x, size_t)
+                {
+                    using T = std::remove_reference_t<decltype(x)>;
+                    new (ndata.get() + r*stride + type->items[i].offset)
+                        T(std::move(x));
+                    x.~T();
+                });
+        data = std::move(ndata);
+        cap = n;
+    }
+
+    // new rows are zero filled
+    void resize(size_t n)
+    {
+        while (rows > n) pop_back();
+        if (n > cap) reserve(std::max(n, cap * 2));
+        if (n > rows)
+        {
+            memset(data.get() + rows * stride, 0, (n - rows) * stride);
+            for (; rows < n; ++rows)
+                for (auto i : complex_items)
+                    GetRow(rows).Visit(i, [](auto& x, size_t)
+                    { new (&x) std::remove_reference_t<decltype(x)>; });
+        }
+    }
+
+    Row emplace_back()
+    {
+        resize(rows + 1);
+        return back();
+    }
+
+    void pop_back() noexcept
+    {
+        NEPTOOLS_ASSERT_MSG(rows, "pop_back on empty table");
+        --rows;
+        for (auto i : complex_items)
+            GetRow(rows).Visit(i, [](auto& x, size_t)
+            {
+                using T = std::remove_reference_t<decltype(x)>;
+                x.~T();
+            });
+    }
+
+    void clear() noexcept
+    {
+        if (complex_items.empty()) rows = 0;
+        while (rows) pop_back();
+    }
+
+private:
+    template <typename T>
+    bool IsColumn(size_t i) const
+    {
+        return i < type->item_count &&
+            type->items[i].idx == Struct::template GetIndexFromType<T>();
+    }
+
+    // unchecked, for rows being constructed or destroyed
+    Row GetRow(size_t r) noexcept
+    { return {type.get(), data.get() + r * stride}; }
+    char* GetCell(size_t r, size_t i) noexcept
+    { return data.get() + r * stride + type->items[i].offset; }
+
+    TypePtr type;
+    size_t stride = 0;
+    std::vector<size_t> complex_items; // indices of non-trivial items
+    std::unique_ptr<char[]> data;
+    size_t rows = 0, cap = 0;
+};
+
+template <typename... Args>
+constexpr const bool DynamicTable<Args...>::TRIVIAL[];
+
+}
+#endif
@@ -2,6 +2,7 @@
 #include "item.hpp"
 #include "../utils.hpp"
 #include "../except.hpp"
+#include <algorithm>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
@@ -10,7 +11,7 @@ namespace Neptools
 {
 
 Context::Context()
-    : ItemWithChildren{Key{}, this}
+    : ItemWithChildren{Key{KIND}, this}
 {}
 
 Context::~Context()
@@ -27,14 +28,8 @@ void Context::SetupParseFrom(Item& item)
 void Context::Fixup()
 {
     pmap.clear();
-
-    FilePosition pos = 0;
-    for (auto& c : GetChildren())
-    {
-        c.UpdatePosition(pos);
-        pos += c.GetSize();
-    }
-    // todo? size = pos;
+    Fixup_(0);
+    dirty = false;
 }
 
 
@@ -122,9 +117,71 @@ ItemPointer Context::GetPointer(FilePosition pos) const noexcept
     return {it->second, pos - it->first};
 }
 
-void Context::Dispose() noexcept
+void Context::QueueParse(ItemPointer ptr, ParseFun fun)
+{
+    parse_queue.emplace_back(ToFilePos(ptr), fun);
+    if (!parse_queue_running) RunParseQueue();
+}
+
+void Context::RunParseQueue()
+{
+    parse_queue_running = true;
+    try
+    {
+        while (!parse_queue.empty())
+        {
+            auto x = parse_queue.back();
+            parse_queue.pop_back();
+            auto size = parse_queue.size();
+            x.second(GetPointer(x.first));
+
+            // process items queued by the same function in order, this way we
+            // visit items in the same order as a recursive parser would
+            std::reverse(parse_queue.begin() + size, parse_queue.end());
+        }
+    }
+    catch (...)
+    {
+        parse_queue.clear();
+        parse_queue_running = false;
+        throw;
+    }
+    parse_queue_running = false;
+}
+
+size_t Context::TakeSnapshot()
+{
+    snapshots.push_back(undo_log.size());
+    ++snapshot_generation;
+    return snapshots.size() - 1;
+}
+
+void Context::Rollback(size_t id)
+{
+    NEPTOOLS_ASSERT_MSG(id < snapshots.size(), "invalid snapshot");
+    while (undo_log.size() > snapshots[id])
+    {
+        auto& e = undo_log.back();
+        e.undo();
+        e.item->InvalidateSize();
+        undo_log.pop_back();
+    }
+    snapshots.resize(id+1);
+    // restored items must save their state again on the next modification
+    ++snapshot_generation;
+}
+
+void Context::DropSnapshots() noexcept
 {
+    undo_log.clear();
+    snapshots.clear();
+}
+
+void Context::Clear() noexcept
+{
+    DropSnapshots();
     pmap.clear();
+    parse_queue.clear();
     struct Disposer
     {
         void operator()(Label* l)
@@ -137,8 +194,72 @@ void Context::Dispose() noexcept
         }
     };
     labels.clear_and_dispose(Disposer{});
+
+    // don't unregister the items one by one
+    auto kinds = std::move(tracked);
+    tracked.clear();
     GetChildren().clear();
+    for (auto& t : kinds) t.items.clear();
+    tracked = std::move(kinds);
+}
+
+void Context::TrackKind(ItemKind kind)
+{
+    for (const auto& t : tracked)
+        if (t.kind == kind) return;
+
+    tracked.push_back({kind, false, {}});
+    auto& items = tracked.back().items;
+    ForEachItem<Item>(static_cast<Item&>(*this), [&](Item& it)
+    { if (it.GetKind() == kind) items.push_back(&it); });
+}
+
+const std::vector<Item*>& Context::GetTrackedItems(ItemKind kind) const
+{
+    for (const auto& t : tracked)
+        if (t.kind == kind)
+        {
+            if (!t.sorted)
+            {
+                std::sort(t.items.begin(), t.items.end(),
+                          [](Item* a, Item* b)
+                          { return a->GetPosition() < b->GetPosition(); });
+                t.sorted = true;
+            }
+            return t.items;
+        }
+    NEPTOOLS_THROW(std::logic_error{"Context::GetTrackedItems: kind not tracked"});
+}
+
+void Context::TrackAdd(Item& item)
+{
+    ForEachItem<Item>(item, [&](Item& it)
+    {
+        for (auto& t : tracked)
+            if (t.kind == it.GetKind())
+            {
+                t.items.push_back(&it);
+                t.sorted = false;
+            }
+    });
+}
 
+void Context::TrackRemove(Item& item) noexcept
+{
+    ForEachItem<Item>(item, [&](Item& it)
+    {
+        for (auto& t : tracked)
+            if (t.kind == it.GetKind())
+            {
+                auto i = std::find(t.items.begin(), t.items.end(), &it);
+                if (i != t.items.end()) t.items.erase(i);
+            }
+    });
+}
+
+void Context::Dispose() noexcept
+{
+    Clear();
     ItemWithChildren::Dispose();
 }
 
@@ -7,8 +7,10 @@
 
 #include <boost/exception/info.hpp>
 #include <boost/intrusive/set.hpp>
+#include <functional>
 #include <string>
 #include <map>
+#include <vector>
 
 namespace Neptools
 {
@@ -18,12 +20,21 @@ class Context : public ItemWithChildren
 public:
     Context();
     ~Context();
+    static constexpr ItemKind KIND = ItemKind::CONTEXT;
+    using KindOwner = Context;
 
     void Fixup() override;
 
     template <typename T, typename... Args>
     NotNull<SmartPtr<T>> Create(Args&&... args)
-    { return MakeSmart<T>(Item::Key{}, this, std::forward<Args>(args)...); }
+    {
+        auto ret = MakeSmart<T>(
+            Item::Key{T::KIND}, this, std::forward<Args>(args)...);
+        if (created_items && T::KIND != ItemKind::RAW &&
+            T::KIND != ItemKind::EOF_ITEM)
+            created_items->push_back(ret.get());
+        return ret;
+    }
 
     const Label& GetLabel(const std::string& name) const;
     const Label& CreateLabel(std::string name, ItemPointer ptr);
@@ -38,15 +49,50 @@ public:
 
     ItemPointer GetPointer(FilePosition pos) const noexcept;
 
+    // Parsers must not recurse into referenced items (scripts can be long
+    // enough to blow the stack), instead they queue them here. Queued
+    // functions are called with a pointer to the same file position, after
+    // the current one returns. If called outside of a queue run, it processes
+    // the queue before returning.
+    using ParseFun = void (*)(ItemPointer);
+    void QueueParse(ItemPointer ptr, ParseFun fun);
+
+    // Cheap undo for trial edits (like importing a txt, dumping it and
+    // throwing the result away). Taking a snapshot is O(1), items save their
+    // state when they're first modified after it (Item::PrepareModify), so
+    // only the modified items are copied. Changes to the item tree itself
+    // (splitting, replacing items, creating labels) are not recorded.
+    size_t TakeSnapshot();
+    // Restore the state at snapshot id. The snapshot stays active, later ones
+    // are dropped. Call Fixup afterwards.
+    void Rollback(size_t id);
+    // Forget every snapshot, keeping the current state.
+    void DropSnapshots() noexcept;
+
     void Dispose() noexcept override;
 
+    // Items of tracked kinds are registered while they're part of this
+    // context's item tree (updated when items are added, moved, replaced or
+    // removed), so they can be listed without walking the tree.
+    void TrackKind(ItemKind kind);
+    // the registered items of a tracked kind, ordered by position
+    const std::vector<Item*>& GetTrackedItems(ItemKind kind) const;
+
 protected:
     void SetupParseFrom(Item& item);
 
 private:
     static void FilterLabelName(std::string& name);
+    void RunParseQueue();
+    // item (with its children) was added to/removed from the tree
+    void TrackAdd(Item& item);
+    void TrackRemove(Item& item) noexcept;
+    // remove every item and label, but keep the context usable
+    void Clear() noexcept;
 
     friend class Item;
+    friend class ParseCache;
+    friend struct ItemListTraits;
 
     // properties needed: stable pointers
     using LabelsMap = boost::intrusive::set<
@@ -59,6 +105,31 @@ private:
     // properties needed: sorted
     using PointerMap = std::map<FilePosition, Item*>;
     PointerMap pmap;
+
+    // store positions, not ItemPointers: items are split while processing
+    std::vector<std::pair<FilePosition, ParseFun>> parse_queue;
+    bool parse_queue_running = false;
+
+    struct Tracked
+    {
+        ItemKind kind;
+        mutable bool sorted;
+        mutable std::vector<Item*> items;
+    };
+    std::vector<Tracked> tracked;
+
+    // if set, Create records the non raw items here, see ParseCache
+    std::vector<Item*>* created_items = nullptr;
+
+    struct UndoEntry
+    {
+        NotNull<SmartPtr<Item>> item;
+        std::function<void ()> undo;
+    };
+    std::vector<UndoEntry> undo_log;
+    // undo_log sizes when the snapshots were taken
+    std::vector<size_t> snapshots;
+    uint32_t snapshot_generation = 0;
 };
 
 using AffectedLabel = boost::error_info<struct AffectedLabelTag, std::string>;
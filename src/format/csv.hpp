@@ -0,0 +1,70 @@
+#ifndef UUID_5B4CAE93_D866_47FD_954E_E1E589BC062B
+#define UUID_5B4CAE93_D866_47FD_954E_E1E589BC062B
+#pragma once
+
+#include "../utils.hpp"
+#include <cstdio>
+#include <string>
+
+namespace Neptools
+{
+namespace Csv
+{
+
+// Formatting and parsing of csv fields, without going through iostreams
+
+inline void AppendUint(std::string& out, uint64_t x)
+{
+    char buf[20];
+    auto end = buf + sizeof(buf), p = end;
+    do *--p = '0' + x % 10; while (x /= 10);
+    out.append(p, end);
+}
+
+// 9 significant digits round-trip every float
+inline void AppendFloat(std::string& out, float x)
+{
+    char buf[32];
+    auto n = snprintf(buf, sizeof(buf), "%.9g", x);
+    out.append(buf, n);
+}
+
+// Quotes str if it contains a special character, or if quote is set
+inline void AppendString(std::string& out, StringView str, char sep, bool quote)
+{
+    for (char c : str)
+        if (c == sep || c == '"' || c == '\n' || c == '\r') quote = true;
+    if (!quote)
+    {
+        out.append(str.data(), str.size());
+        return;
+    }
+
+    out.push_back('"');
+    for (char c : str)
+    {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+// Decimal digits only, fails if the value is larger than max
+inline bool ParseUint(StringView str, uint64_t max, uint64_t& out)
+{
+    if (str.empty()) return false;
+    uint64_t x = 0;
+    for (char c : str)
+    {
+        if (c < '0' || c > '9') return false;
+        unsigned d = c - '0';
+        if (x > (max - d) / 10) return false;
+        x = x*10 + d;
+    }
+    out = x;
+    return true;
+}
+
+}
+}
+#endif
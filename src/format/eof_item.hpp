@@ -10,6 +10,8 @@ namespace Neptools
 class EofItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::EOF_ITEM;
+    using KindOwner = EofItem;
     using Item::Item;
 
     void Dump_(Sink&) const override {}
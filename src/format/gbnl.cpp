@@ -1,15 +1,23 @@
 #include "gbnl.hpp"
+#include "csv.hpp"
 #include "../sink.hpp"
+#include "../txt_reader.hpp"
+#include "../txt_writer.hpp"
 #include "../except.hpp"
 
-#include <map>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
 #include <boost/algorithm/string/replace.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/container/small_vector.hpp>
+#include <boost/endian/conversion.hpp>
 #include <boost/preprocessor/repetition/repeat.hpp>
 
 //#define STRTOOL_COMPAT
 
+#define NEPTOOLS_LOG_NAME "gbnl"
+#include "../logger_helper.hpp"
+
 namespace Neptools
 {
 
@@ -32,6 +40,9 @@ void Gbnl::Header::Validate(size_t chunk_size) const
 #undef VALIDATE
 }
 
+// at most this many bytes of rows are converted at a time
+static constexpr size_t ROW_BLOCK_SIZE = 64*1024;
+
 static size_t GetSize(uint16_t type)
 {
     switch (type)
@@ -51,38 +62,155 @@ Gbnl::Gbnl(Source src)
     AddInfo(&Gbnl::Parse_, ADD_SOURCE(src), this, src);
 }
 
-void Gbnl::Parse_(Source& src)
+Gbnl::Header Gbnl::ReadHeader(Source& src)
 {
-#define VALIDATE(msg, x) NEPTOOLS_VALIDATE_FIELD("Gbnl" msg, x)
-
     src.CheckSize(sizeof(Header));
     auto foot = src.PreadGen<Header>(0);
-    if (memcmp(foot.magic, "GSTL", 4) == 0)
-    {
-        is_gstl = true;
-    }
-    else
-    {
+    if (memcmp(foot.magic, "GSTL", 4) != 0)
         src.PreadGen(src.GetSize() - sizeof(Header), foot);
-        is_gstl = false;
-    }
-
     foot.Validate(src.GetSize());
+    return foot;
+}
+
+void Gbnl::Parse_(Source& src)
+{
+#define VALIDATE(msg, x) NEPTOOLS_VALIDATE_FIELD("Gbnl" msg, x)
+
+    auto foot = ReadHeader(src);
+    is_gstl = memcmp(foot.magic, "GSTL", 4) == 0;
     flags = foot.flags;
     field_28 = foot.field_28;
     field_30 = foot.field_30;
 
-    src.Seek(foot.offset_types);
     msg_descr_size = foot.msg_descr_size;
-    size_t calc_offs = 0;
+    std::vector<TypeDescriptor> descrs(foot.count_types);
+    src.Pread(foot.offset_types, reinterpret_cast<char*>(descrs.data()),
+              descrs.size() * sizeof(TypeDescriptor));
+    layout = Layout::Get(descrs.data(), descrs.size(), msg_descr_size);
+    messages = Table{layout->type, foot.count_msgs};
+    const auto& codec = layout->codec;
+
+    // strings can point directly into the source if it stays in memory
+    auto resident = src.GetResidentData();
+    if (resident) string_source = src;
+    else string_source = boost::none;
+
+    // decode blocks of rows, straight from memory if possible
+    auto row_size = msg_descr_size;
+    auto block = std::max<size_t>(
+        1, ROW_BLOCK_SIZE / std::max<size_t>(1, row_size));
+    std::unique_ptr<char[]> buf;
+    for (size_t r = 0, n; r < foot.count_msgs; r += n)
+    {
+        n = std::min<size_t>(block, foot.count_msgs - r);
+        auto offs = foot.descr_offset + r * row_size;
+        const char* rows;
+        if (resident)
+            rows = resident + offs;
+        else
+        {
+            if (!buf) buf.reset(new char[block * row_size]);
+            src.Pread(offs, buf.get(), n * row_size);
+            rows = buf.get();
+        }
+        codec.Decode(rows, n, messages, r);
 
-    //std::vector<uint16_t> offsets;
-    //offsets.reserve(foot.count_types);
+        for (size_t j = 0; j < n; ++j)
+            for (const auto& s : codec.GetStrings())
+            {
+                auto& os = messages[r+j].Get<OffsetString>(s.item);
+                uint32_t offs = *reinterpret_cast<
+                    const boost::endian::little_uint32_t*>(
+                        rows + j*row_size + s.file_offset);
+                if (offs == 0xffffffff)
+                {
+                    os.offset = -1;
+                    continue;
+                }
+
+                VALIDATE("", offs < src.GetSize() - foot.offset_msgs);
+                auto str = foot.offset_msgs + offs;
+                if (resident)
+                {
+                    auto len = strnlen(resident + str, src.GetSize() - str);
+                    VALIDATE(" unterminated string", str + len < src.GetSize());
+                    os = OffsetString::View({resident + str, len}, 0);
+                }
+                else
+                    os = {src.PreadCString(str), 0};
+            }
+    }
+    RecalcSize();
+
+    VALIDATE(" invalid size after repack", msg_descr_size == foot.msg_descr_size);
+    VALIDATE(" invalid size after repack", GetSize() == src.GetSize());
+#undef VALIDATE
+}
+
+void Gbnl::Pad(uint16_t diff, Struct::TypeBuilder& bld, bool& uint8_in_progress)
+{
+    if (uint8_in_progress)
+    {
+        uint8_in_progress = false;
+        if (diff <= 3) // probably padding
+            bld.Add<uint8_t>();
+        else
+        {
+            bld.Add<FixStringTag>(diff+1);
+            return;
+        }
+    }
+
+    if (diff) bld.Add<PaddingTag>(diff);
+}
+
+namespace
+{
+struct LayoutCache
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<const Gbnl::Layout>> map;
+    size_t sweep_at = 16; // remove expired entries at this size
+};
+
+LayoutCache& GetLayoutCache()
+{
+    static LayoutCache cache;
+    return cache;
+}
+}
+
+Gbnl::Layout::Layout(Struct::TypePtr type_)
+    : type{std::move(type_)}, codec{*type}
+{
+    auto uint32 = Struct::GetIndexFromType<uint32_t>();
+    if (type->item_count == 9 && type->items[0].idx == uint32) // rebirths
+        id_item = 8;
+    else if (type->item_count == 107 && type->items[0].idx == uint32) // vii
+        id_item = 105;
+    gstl_ids = type->item_count == 3 && type->items[1].idx == uint32;
+}
+
+std::shared_ptr<const Gbnl::Layout> Gbnl::Layout::Get(
+    const TypeDescriptor* descrs, size_t count, size_t msg_descr_size)
+{
+#define VALIDATE(msg, x) NEPTOOLS_VALIDATE_FIELD("Gbnl" msg, x)
+    std::string key(reinterpret_cast<const char*>(&msg_descr_size),
+                    sizeof(msg_descr_size));
+    key.append(reinterpret_cast<const char*>(descrs),
+               count * sizeof(TypeDescriptor));
+
+    auto& cache = GetLayoutCache();
+    std::lock_guard<std::mutex> lock{cache.mutex};
+    auto& entry = cache.map[key];
+    if (auto ret = entry.lock()) return ret;
+
+    size_t calc_offs = 0;
     Struct::TypeBuilder bld;
     bool uint8_in_progress = false;
-    for (size_t i = 0; i < foot.count_types; ++i)
+    for (size_t i = 0; i < count; ++i)
     {
-        auto type = src.ReadGen<TypeDescriptor>();
+        const auto& type = descrs[i];
         VALIDATE("unordered types", calc_offs <= type.offset);
 
         Pad(type.offset - calc_offs, bld, uint8_in_progress);
@@ -115,137 +243,163 @@ void Gbnl::Parse_(Source& src)
     }
     Pad(msg_descr_size - calc_offs, bld, uint8_in_progress);
 
-    type = bld.Build();
+    auto ret = std::make_shared<const Layout>(bld.Build());
+    VALIDATE(" invalid types", ret->codec.GetRowSize() == msg_descr_size);
+    entry = ret;
 
-    auto msgs = foot.descr_offset;
-    messages.reserve(foot.count_msgs);
-    for (size_t i = 0; i < foot.count_msgs; ++i)
+    if (cache.map.size() >= cache.sweep_at)
     {
-        messages.emplace_back(type);
-        auto& m = messages.back();
-        src.Seek(msgs);
-        for (size_t i = 0; i < type->item_count; ++i)
-        {
-            switch (type->items[i].idx)
-            {
-            case Struct::GetIndexFromType<uint8_t>():
-                m.Get<uint8_t>(i) = src.ReadLittleUint8();
-                break;
-            case Struct::GetIndexFromType<uint16_t>():
-                m.Get<uint16_t>(i) = src.ReadLittleUint16();
-                break;
-            case Struct::GetIndexFromType<uint32_t>():
-                m.Get<uint32_t>(i) = src.ReadLittleUint32();
-                break;
-            case Struct::GetIndexFromType<uint64_t>():
-                m.Get<uint64_t>(i) = src.ReadLittleUint64();
-                break;
-            case Struct::GetIndexFromType<float>():
-            {
-                union { float f; uint32_t i; } x;
-                x.i = src.ReadLittleUint32();
-                m.Get<float>(i) = x.f;
-                break;
-            }
-            case Struct::GetIndexFromType<OffsetString>():
-            {
-                uint32_t offs = src.ReadLittleUint32();
-                if (offs == 0xffffffff)
-                    m.Get<OffsetString>(i).offset = -1;
-                else
-                {
-                    VALIDATE("", offs < src.GetSize() - foot.offset_msgs);
-                    auto str = foot.offset_msgs + offs;
-
-                    m.Get<OffsetString>(i) = {src.PreadCString(str), 0};
-                }
-                break;
-            }
-            case Struct::GetIndexFromType<FixStringTag>():
-                src.Read(m.Get<FixStringTag>(i).str, type->items[i].size);
-                break;
-            case Struct::GetIndexFromType<PaddingTag>():
-                src.Read(m.Get<PaddingTag>(i).pad, type->items[i].size);
-                break;
-            }
-        }
-
-        msgs += msg_descr_size;
+        for (auto it = cache.map.begin(); it != cache.map.end(); )
+            if (it->second.expired()) it = cache.map.erase(it);
+            else ++it;
+        cache.sweep_at = std::max<size_t>(16, 2 * cache.map.size());
     }
-    RecalcSize();
-
-    VALIDATE(" invalid size after repack", msg_descr_size == foot.msg_descr_size);
-    VALIDATE(" invalid size after repack", GetSize() == src.GetSize());
+    return ret;
 #undef VALIDATE
 }
 
-void Gbnl::Pad(uint16_t diff, Struct::TypeBuilder& bld, bool& uint8_in_progress)
+size_t Gbnl::Layout::GetInternedCount()
 {
-    if (uint8_in_progress)
-    {
-        uint8_in_progress = false;
-        if (diff <= 3) // probably padding
-            bld.Add<uint8_t>();
-        else
-        {
-            bld.Add<FixStringTag>(diff+1);
-            return;
-        }
-    }
-
-    if (diff) bld.Add<PaddingTag>(diff);
+    auto& cache = GetLayoutCache();
+    std::lock_guard<std::mutex> lock{cache.mutex};
+    size_t ret = 0;
+    for (const auto& it : cache.map) ret += !it.second.expired();
+    return ret;
 }
 
-namespace
+template <typename T>
+static void CopyLittle(char* dst, const char* src) noexcept
 {
-struct WriteDescr
+    T x;
+    memcpy(&x, src, sizeof(T));
+    boost::endian::little_to_native_inplace(x);
+    memcpy(dst, &x, sizeof(T));
+}
+
+Gbnl::RowCodec::RowCodec(const Struct::Type& type)
 {
-    WriteDescr(Byte* ptr) : ptr{ptr} {}
-    Byte* ptr;
-    // todo: template
-    void operator()(uint8_t x, size_t)
+    auto num = [](size_t size)
     {
-        *reinterpret_cast<boost::endian::little_uint8_t*>(ptr) = x;
-        ptr += 1;
-    }
-    void operator()(uint16_t x, size_t)
-    {
-        *reinterpret_cast<boost::endian::little_uint16_t*>(ptr) = x;
-        ptr += 2;
-    }
-    void operator()(uint32_t x, size_t)
-    {
-        *reinterpret_cast<boost::endian::little_uint32_t*>(ptr) = x;
-        ptr += 4;
-    }
-    void operator()(uint64_t x, size_t)
-    {
-        *reinterpret_cast<boost::endian::little_uint64_t*>(ptr) = x;
-        ptr += 8;
-    }
-    void operator()(float y, size_t)
+        if (boost::endian::order::native == boost::endian::order::little)
+            return OpType::COPY;
+        switch (size)
+        {
+        case 2: return OpType::COPY16;
+        case 4: return OpType::COPY32;
+        case 8: return OpType::COPY64;
+        default: return OpType::COPY;
+        }
+    };
+    auto add = [](std::vector<Op>& ops, Op op)
     {
-        uint32_t x = *reinterpret_cast<uint32_t*>(&y);
-        *reinterpret_cast<boost::endian::little_uint32_t*>(ptr) = x;
-        ptr += 4;
-    }
-    void operator()(const Gbnl::OffsetString& os, size_t)
+        if (!ops.empty() && op.type == OpType::COPY &&
+            ops.back().type == OpType::COPY &&
+            ops.back().file + ops.back().size == op.file &&
+            ops.back().mem + ops.back().size == op.mem)
+            ops.back().size += op.size;
+        else
+            ops.push_back(op);
+    };
+
+    uint32_t file = 0;
+    for (size_t i = 0; i < type.item_count; ++i)
     {
-        *reinterpret_cast<boost::endian::little_uint32_t*>(ptr) = os.offset;
-        ptr += 4;
+        const auto& it = type.items[i];
+        Op op{file, static_cast<uint32_t>(it.offset),
+              static_cast<uint32_t>(it.size), OpType::COPY};
+        switch (it.idx)
+        {
+        case Struct::GetIndexFromType<uint16_t>():
+        case Struct::GetIndexFromType<uint32_t>():
+        case Struct::GetIndexFromType<uint64_t>():
+        case Struct::GetIndexFromType<float>():
+            op.type = num(it.size);
+            // fallthrough
+        case Struct::GetIndexFromType<uint8_t>():
+        case Struct::GetIndexFromType<PaddingTag>():
+            add(decode_ops, op);
+            add(encode_ops, op);
+            break;
+
+        case Struct::GetIndexFromType<FixStringTag>():
+            add(decode_ops, op);
+            op.type = OpType::FIX_STRING;
+            encode_ops.push_back(op);
+            break;
+
+        case Struct::GetIndexFromType<OffsetString>():
+            op.size = 4;
+            op.type = OpType::STRING;
+            encode_ops.push_back(op);
+            strings.push_back({file, i});
+            break;
+        }
+        file_offsets.push_back(file);
+        file += op.size;
     }
-    void operator()(const Gbnl::FixStringTag& fs, size_t len)
+    row_size = file;
+}
+
+void Gbnl::RowCodec::Decode(
+    const char* src, size_t count, Table& dst, size_t first) const
+{
+    for (size_t r = 0; r < count; ++r, src += row_size)
     {
-        memset(ptr, 0, len);
-        strncpy(reinterpret_cast<char*>(ptr), fs.str, len-1);
-        ptr += len;
+        auto row = dst[first + r].GetData();
+        for (const auto& op : decode_ops)
+            switch (op.type)
+            {
+            case OpType::COPY:
+                memcpy(row + op.mem, src + op.file, op.size);
+                break;
+            case OpType::COPY16:
+                CopyLittle<uint16_t>(row + op.mem, src + op.file);
+                break;
+            case OpType::COPY32:
+                CopyLittle<uint32_t>(row + op.mem, src + op.file);
+                break;
+            case OpType::COPY64:
+                CopyLittle<uint64_t>(row + op.mem, src + op.file);
+                break;
+            case OpType::FIX_STRING:
+            case OpType::STRING:
+                NEPTOOLS_UNREACHABLE("Invalid decode op");
+            }
     }
-    void operator()(const Gbnl::PaddingTag& pd, size_t len)
+}
+
+void Gbnl::RowCodec::Encode(
+    const Table& src, size_t first, size_t count, char* dst) const
+{
+    for (size_t r = 0; r < count; ++r, dst += row_size)
     {
-        memcpy(ptr, pd.pad, len);
-        ptr += len;
+        auto row = src[first + r].GetData();
+        for (const auto& op : encode_ops)
+            switch (op.type)
+            {
+            case OpType::COPY:
+                memcpy(dst + op.file, row + op.mem, op.size);
+                break;
+            case OpType::COPY16:
+                CopyLittle<uint16_t>(dst + op.file, row + op.mem);
+                break;
+            case OpType::COPY32:
+                CopyLittle<uint32_t>(dst + op.file, row + op.mem);
+                break;
+            case OpType::COPY64:
+                CopyLittle<uint64_t>(dst + op.file, row + op.mem);
+                break;
+            case OpType::FIX_STRING:
+                memset(dst + op.file, 0, op.size);
+                strncpy(dst + op.file, row + op.mem, op.size - 1);
+                break;
+            case OpType::STRING:
+                *reinterpret_cast<boost::endian::little_uint32_t*>(
+                    dst + op.file) =
+                    reinterpret_cast<const OffsetString*>(row + op.mem)->offset;
+                break;
+            }
     }
-};
 }
 
 void Gbnl::Dump_(Sink& sink) const
@@ -256,87 +410,93 @@ void Gbnl::Dump_(Sink& sink) const
     // VII scrips: 392
     // gbin/gstrs are usually smaller than VII scripts
     // RB3's stdungeon.gbin: 7576, stsqdungeon.gbin: 1588 though
-    //std::cerr << msg_descr_size << std::endl;
-    boost::container::small_vector<Byte, 392> msgd;
-    msgd.resize(msg_descr_size);
+    const auto& codec = layout->codec;
+    NEPTOOLS_ASSERT(codec.GetRowSize() == msg_descr_size);
+    auto msgs_end = msg_descr_size * messages.size();
+    auto msgs_end_round = Align(msgs_end);
+    auto control_end = msgs_end_round + sizeof(TypeDescriptor) * real_item_count;
+    auto control_end_round = Align(control_end);
+    auto pool_end = control_end_round + msgs_size;
+    auto size = Align(pool_end);
 
-    for (const auto& m : messages)
+    // rows, types and the string pool are built in one buffer: directly in
+    // the sink if it fits into its window
+    std::unique_ptr<char[]> tmp;
+    auto buf = reinterpret_cast<char*>(sink.Claim(size));
+    if (!buf)
     {
-        m.ForEach(WriteDescr{msgd.data()});
-        sink.Write({msgd.data(), msg_descr_size});
+        tmp.reset(new char[size]);
+        buf = tmp.get();
     }
 
-    auto msgs_end = msg_descr_size * messages.size();
-    auto msgs_end_round = Align(msgs_end);
-    sink.Pad(msgs_end_round - msgs_end);
+    codec.Encode(messages, 0, messages.size(), buf);
+    memset(buf + msgs_end, 0, msgs_end_round - msgs_end);
 
-    TypeDescriptor ctrl;
+    auto type = messages.GetRawType().get();
+    auto ctrl = reinterpret_cast<TypeDescriptor*>(buf + msgs_end_round);
     uint16_t offs = 0;
     for (size_t i = 0; i < type->item_count; ++i)
     {
-        ctrl.offset = offs;
+        ctrl->offset = offs;
         switch (type->items[i].idx)
         {
         case Struct::GetIndexFromType<uint8_t>():
-            ctrl.type = TypeDescriptor::UINT8;
+            ctrl->type = TypeDescriptor::UINT8;
             offs += 1;
             break;
         case Struct::GetIndexFromType<uint16_t>():
-            ctrl.type = TypeDescriptor::UINT16;
+            ctrl->type = TypeDescriptor::UINT16;
             offs += 2;
             break;
         case Struct::GetIndexFromType<uint32_t>():
-            ctrl.type = TypeDescriptor::UINT32;
+            ctrl->type = TypeDescriptor::UINT32;
             offs += 4;
             break;
         case Struct::GetIndexFromType<uint64_t>():
-            ctrl.type = TypeDescriptor::UINT64;
+            ctrl->type = TypeDescriptor::UINT64;
             offs += 8;
             break;
         case Struct::GetIndexFromType<float>():
-            ctrl.type = TypeDescriptor::FLOAT;
+            ctrl->type = TypeDescriptor::FLOAT;
             offs += 4;
             break;
         case Struct::GetIndexFromType<OffsetString>():
-            ctrl.type = TypeDescriptor::STRING;
+            ctrl->type = TypeDescriptor::STRING;
             offs += 4;
             break;
         case Struct::GetIndexFromType<FixStringTag>():
-            ctrl.type = TypeDescriptor::UINT8;
+            ctrl->type = TypeDescriptor::UINT8;
             offs += type->items[i].size;
             break;
         case Struct::GetIndexFromType<PaddingTag>():
             offs += type->items[i].size;
-            goto skip;
+            continue;
         }
-        sink.WriteGen(ctrl);
-    skip: ;
+        ++ctrl;
     }
-    auto control_end = msgs_end_round + sizeof(TypeDescriptor) * real_item_count;
-    auto control_end_round = Align(control_end);
-    sink.Pad(control_end_round - control_end);
+    NEPTOOLS_ASSERT(reinterpret_cast<char*>(ctrl) == buf + control_end);
+    memset(buf + control_end, 0, control_end_round - control_end);
 
+    // the pool in order of first occurrence, as laid out by RecalcSize
+    auto pool = buf + control_end_round;
     size_t offset = 0;
-    for (const auto& m : messages)
-        for (size_t i = 0; i < m.GetSize(); ++i)
-            if (m.Is<OffsetString>(i))
+    for (auto m : messages)
+        for (auto i : string_items)
+        {
+            auto& ofs = m.Get<OffsetString>(i);
+            if (ofs.offset == offset)
             {
-                auto& ofs = m.Get<OffsetString>(i);
-                if (ofs.offset == offset)
-                {
-                    sink.WriteCString(ofs.str);
-                    offset += ofs.str.size() + 1;
-                }
+                auto str = ofs.Get();
+                NEPTOOLS_ASSERT(offset + str.size() < msgs_size);
+                memcpy(pool + offset, str.data(), str.size());
+                pool[offset + str.size()] = '\0';
+                offset += str.size() + 1;
             }
-
+        }
     NEPTOOLS_ASSERT(offset == msgs_size);
-    auto offset_round = Align(offset);
-    sink.Pad(offset_round - offset);
+    memset(buf + pool_end, 0, size - pool_end);
 
-    // sanity checks
-    NEPTOOLS_ASSERT(msgs_end_round == Align(msg_descr_size * messages.size()));
-    NEPTOOLS_ASSERT(control_end_round == Align(msgs_end_round +
-        sizeof(TypeDescriptor) * real_item_count));
+    if (tmp) sink.Write({buf, size});
     if (!is_gstl) DumpHeader(sink);
 }
 
@@ -377,7 +537,7 @@ struct Print
         if (ofs.offset == static_cast<uint32_t>(-1))
             os << "null";
         else
-            DumpBytes(os, ofs.str);
+            DumpBytes(os, ofs.Get());
     }
     void operator()(const Gbnl::FixStringTag& fs, size_t)
     { DumpBytes(os, fs.str); }
@@ -393,6 +553,8 @@ void Gbnl::Inspect_(std::ostream& os) const
     os << (is_gstl ? "gstl(" : "gbnl(") << flags << ", " << field_28 << ", "
        << field_30 << ", types[";
 
+    auto type = messages.GetRawType().get();
+
     for (size_t i = 0; i < type->item_count; ++i)
     {
         if (i != 0) os << ", ";
@@ -414,7 +576,7 @@ void Gbnl::Inspect_(std::ostream& os) const
     }
 
     os << "], messages[\n";
-    for (const auto& m : messages)
+    for (auto m : messages)
     {
         os << "  (";
         for (size_t i = 0; i < m.GetSize(); ++i)
@@ -427,8 +589,59 @@ void Gbnl::Inspect_(std::ostream& os) const
     os << "])";
 }
 
+uint64_t Gbnl::OffsetString::Hash(StringView str) noexcept
+{
+    uint64_t hash = HASH_BASIS;
+    for (auto c : str)
+        hash = (hash ^ static_cast<Byte>(c)) * 0x100000001b3;
+    return hash;
+}
+
+namespace
+{
+// open addressing hash set of the strings already placed in the pool
+class StringPool
+{
+public:
+    explicit StringPool(size_t max_count)
+    {
+        size_t n = 16;
+        while (n < 2*max_count) n *= 2;
+        slots.resize(n);
+    }
+
+    // offset of an equal string already in the pool, or add str at offset
+    uint32_t Insert(const Gbnl::OffsetString& str, uint32_t offset)
+    {
+        auto mask = slots.size() - 1;
+        for (auto i = str.GetHash() & mask; ; i = (i+1) & mask)
+        {
+            auto& s = slots[i];
+            if (!s.str.data())
+            {
+                s = {str.GetHash(), str.Get(), offset};
+                return offset;
+            }
+            if (s.hash == str.GetHash() && s.str == str.Get())
+                return s.offset;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t hash;
+        StringView str;
+        uint32_t offset;
+    };
+    std::vector<Slot> slots;
+};
+}
+
 void Gbnl::RecalcSize()
 {
+    auto type = messages.GetRawType().get();
+    string_items.clear();
     size_t len = 0, count = 0;
     for (size_t i = 0; i < type->item_count; ++i)
         switch (type->items[i].idx)
@@ -438,7 +651,8 @@ void Gbnl::RecalcSize()
         case Struct::GetIndexFromType<uint32_t>():     len += 4; ++count; break;
         case Struct::GetIndexFromType<uint64_t>():     len += 8; ++count; break;
         case Struct::GetIndexFromType<float>():        len += 4; ++count; break;
-        case Struct::GetIndexFromType<OffsetString>(): len += 4; ++count; break;
+        case Struct::GetIndexFromType<OffsetString>():
+            len += 4; ++count; string_items.push_back(i); break;
         case Struct::GetIndexFromType<FixStringTag>():
             len += type->items[i].size; ++count; break;
         case Struct::GetIndexFromType<PaddingTag>():
@@ -446,23 +660,20 @@ void Gbnl::RecalcSize()
         }
     msg_descr_size = len;
     real_item_count = count;
+    if (!layout || layout->type != messages.GetRawType())
+        layout = std::make_shared<const Layout>(messages.GetRawType());
 
-    std::map<std::string, size_t> offset_map;
-    size_t offset = 0;
-    for (auto& m : messages)
-    {
-        NEPTOOLS_ASSERT(m.GetRawType() == type);
-        for (size_t i = 0; i < m.GetSize(); ++i)
-            if (m.Is<OffsetString>(i))
-            {
-                auto& os = m.Get<OffsetString>(i);
-                if (os.offset == static_cast<uint32_t>(-1)) continue;
-                auto x = offset_map.emplace(os.str, offset);
-                if (x.second) // new item inserted
-                    offset += os.str.size() + 1;
-                os.offset = x.first->second;
-            }
-    }
+    StringPool pool{messages.size() * string_items.size()};
+    uint32_t offset = 0;
+    for (auto m : messages)
+        for (auto i : string_items)
+        {
+            auto& os = m.Get<OffsetString>(i);
+            if (os.offset == static_cast<uint32_t>(-1)) continue;
+            os.offset = pool.Insert(os, offset);
+            if (os.offset == offset) // new string
+                offset += os.Get().size() + 1;
+        }
     msgs_size = offset;
 }
 
@@ -480,14 +691,6 @@ FilePosition Gbnl::Align(FilePosition x) const noexcept
     return is_gstl ? x : ((x+15) & ~15);
 }
 
-static const char SEP_DASH_DATA[] = {
-#define REP_MACRO(x,y,z) char(0x81), char(0x5c),
-    BOOST_PP_REPEAT(40, REP_MACRO, )
-#undef REP_MACRO
-    ' '
-};
-static const StringView SEP_DASH{SEP_DASH_DATA, sizeof(SEP_DASH_DATA)};
-
 static const char SEP_DASH_UTF8_DATA[] = {
 #define REP_MACRO(x,y,z) char(0xe2), char(0x80), char(0x95),
     BOOST_PP_REPEAT(40, REP_MACRO, )
@@ -498,7 +701,7 @@ static const StringView SEP_DASH_UTF8{
     SEP_DASH_UTF8_DATA, sizeof(SEP_DASH_UTF8_DATA)};
 
 
-uint32_t Gbnl::GetId(const Gbnl::Struct& m, size_t i, size_t j, size_t& k) const
+uint32_t Gbnl::GetId(Table::ConstRow m, size_t i, size_t j, size_t& k) const
 {
     size_t this_k;
     if (m.Is<Gbnl::OffsetString>(i))
@@ -513,11 +716,9 @@ uint32_t Gbnl::GetId(const Gbnl::Struct& m, size_t i, size_t j, size_t& k) const
         return -1;
 
     // hack
-    if (!is_gstl && m.Is<uint32_t>(0) && (
-            (i == 8 && m.GetSize() == 9) || // rebirths
-            (i == 105 && m.GetSize() == 107))) // vii
+    if (!is_gstl && i == layout->id_item)
         return m.Get<uint32_t>(0);
-    else if (is_gstl && m.GetSize() == 3 && m.Is<uint32_t>(1))
+    else if (is_gstl && layout->gstl_ids)
     {
 #ifdef STRTOOL_COMPAT
         if (i == 0) return -1;
@@ -528,12 +729,12 @@ uint32_t Gbnl::GetId(const Gbnl::Struct& m, size_t i, size_t j, size_t& k) const
         return this_k*10000+j;
 }
 
-void Gbnl::WriteTxt_(std::ostream& os) const
+void Gbnl::WriteTxt_(TxtWriter& wr) const
 {
     //auto sep = field_30 == 8 ? SEP_DASH_UTF8 : SEP_DASH;
 	auto sep = SEP_DASH_UTF8;
     size_t j = 0;
-    for (const auto& m : messages)
+    for (auto m : messages)
     {
         size_t k = 0;
         for (size_t i = 0; i < m.GetSize(); ++i)
@@ -541,99 +742,457 @@ void Gbnl::WriteTxt_(std::ostream& os) const
             auto id = GetId(m, i, j, k);
             if (id != static_cast<uint32_t>(-1))
             {
-                std::string str;
+                StringView str;
                 if (m.Is<FixStringTag>(i))
-                    str = m.Get<FixStringTag>(i).str;
+                {
+                    auto fix = m.Get<FixStringTag>(i).str;
+                    str = {fix, strnlen(fix, m.GetSize(i))};
+                }
                 else
-                    str = m.Get<OffsetString>(i).str;
-                boost::replace_all(str, "\n", "\r\n");
+                    str = m.Get<OffsetString>(i).Get();
 
 #ifdef STRTOOL_COMPAT
-                boost::replace_all(str, "#n", "\r\n");
+                auto compat = str.to_string();
+                boost::replace_all(compat, "#n", "\n");
+                str = compat;
                 if (!str.empty())
 #endif
                 {
-                    os.write(sep.data(), sep.size());
-                    os << id << "\r\n" << str << "\r\n";
+                    wr.Write(sep);
+                    wr.WriteUint(id);
+                    wr.Write("\r\n");
+                    wr.WriteLines(str, "\n");
+                    wr.Write("\r\n");
                 }
             }
         }
         ++j;
     }
-    os.write(sep.data(), sep.size());
-    os << "EOF\r\n";
+    wr.Write(sep);
+    wr.Write("EOF\r\n");
 }
 
-size_t Gbnl::FindDst(uint32_t id, std::vector<Gbnl::Struct>& messages,
-                     size_t& index) const
+// id -> (message, item) of the txt ids, built once per import
+class Gbnl::IdIndex
 {
-    auto size = messages.size();
-    for (size_t j = 0; j < size; ++j)
+public:
+    explicit IdIndex(const Gbnl& gbnl)
+    {
+        const auto& messages = gbnl.messages;
+        for (uint32_t j = 0; j < messages.size(); ++j)
+        {
+            auto m = messages[j];
+            size_t k = 0;
+            for (uint32_t i = 0; i < m.GetSize(); ++i)
+            {
+                auto id = gbnl.GetId(m, i, j, k);
+                if (id != static_cast<uint32_t>(-1))
+                    entries.push_back({id, j, i});
+            }
+        }
+
+        // keeps (message, item) order inside an id
+        std::stable_sort(
+            entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.id < b.id; });
+        ranges.reserve(entries.size());
+        for (uint32_t b = 0, e; b < entries.size(); b = e)
+        {
+            for (e = b+1; e < entries.size() &&
+                     entries[e].id == entries[b].id; ++e);
+            if (e - b > 1) ++duplicates;
+            ranges.emplace(entries[b].id, std::make_pair(b, e));
+        }
+    }
+
+    // number of ids belonging to more than one item
+    size_t GetDuplicateCount() const noexcept { return duplicates; }
+
+    // A duplicate id resolves to its first item at or after message index,
+    // wrapping around, like the sequential search this replaced. index is
+    // updated to the found message.
+    size_t Find(uint32_t id, size_t& index) const
+    {
+        auto it = ranges.find(id);
+        if (it == ranges.end()) return -1;
+
+        auto b = entries.begin() + it->second.first;
+        auto e = entries.begin() + it->second.second;
+        auto x = std::lower_bound(b, e, index, [](const Entry& en, size_t idx)
+                                  { return en.msg < idx; });
+        if (x == e) x = b;
+        index = x->msg;
+        return x->item;
+    }
+
+private:
+    struct Entry
+    {
+        uint32_t id, msg, item;
+    };
+    std::vector<Entry> entries;
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> ranges;
+    size_t duplicates = 0;
+};
+
+void Gbnl::ReadTxt_(TxtReader& rd)
+{
+    IdIndex index{*this};
+    if (index.GetDuplicateCount())
+        WARN << index.GetDuplicateCount() << " ids belong to multiple strings, "
+             << "using the first one after the previous id's message"
+             << std::endl;
+
+    StringView body, rest;
+    std::string buf;
+    if (!rd.Next(body, rest))
+        NEPTOOLS_THROW(DecodeError{"GbnlTxt: EOF"});
+    if (!body.empty())
+        NEPTOOLS_THROW(DecodeError{"GbnlTxt: data before separator"});
+
+    size_t last_index = 0;
+    while (true)
+    {
+        if (!rest.empty() && rest[0] == ' ') rest.remove_prefix(1);
+        if (rest.size() >= 3 && memcmp(rest.data(), "EOF", 3) == 0)
+        {
+            RecalcSize();
+            return;
+        }
+
+        uint32_t id = 0;
+        for (char c : rest)
+        {
+            if (c < '0' || c > '9') break;
+            id = id*10 + (c - '0');
+        }
+        auto pos = index.Find(id, last_index);
+        if (pos == static_cast<size_t>(-1))
+        {
+            NEPTOOLS_THROW(DecodeError{"GbnlTxt: invalid id in input"} <<
+                  FailedId{id});
+        }
+
+        if (!rd.Next(body, rest))
+            NEPTOOLS_THROW(DecodeError{"GbnlTxt: EOF"});
+        auto msg = TxtReader::Normalize(body, "\n", buf);
+        auto m = messages[last_index];
+        if (m.Is<OffsetString>(pos))
+            m.Get<OffsetString>(pos).Set(msg.to_string());
+        else
+        {
+            auto size = m.GetSize(pos) - 1;
+            auto str = m.Get<FixStringTag>(pos).str;
+            auto n = std::min<size_t>(msg.size(), size);
+            memcpy(str, msg.data(), n);
+            memset(str + n, 0, size - n);
+        }
+    }
+}
+
+void Gbnl::ForEachString_(const StringFun& fun) const
+{
+    size_t j = 0;
+    for (auto m : messages)
+    {
+        size_t k = 0;
+        for (size_t i = 0; i < m.GetSize(); ++i)
+            if (GetId(m, i, j, k) != static_cast<uint32_t>(-1))
+            {
+                if (m.Is<FixStringTag>(i))
+                {
+                    auto str = m.Get<FixStringTag>(i).str;
+                    fun({str, strnlen(str, m.GetSize(i))});
+                }
+                else
+                    fun(m.Get<OffsetString>(i).Get());
+            }
+        ++j;
+    }
+}
+
+size_t Gbnl::ReplaceStrings_(const ReplaceFun& fun)
+{
+    size_t j = 0, count = 0;
+    StringView out;
+    for (auto m : messages)
     {
-        auto j2 = (index+j) % size;
-        auto& m = messages[j2];
         size_t k = 0;
         for (size_t i = 0; i < m.GetSize(); ++i)
         {
-            auto tid = GetId(m, i, j2, k);
-            if (tid == id)
+            if (GetId(m, i, j, k) == static_cast<uint32_t>(-1)) continue;
+            if (m.Is<FixStringTag>(i))
+            {
+                auto size = m.GetSize(i) - 1;
+                auto str = m.Get<FixStringTag>(i).str;
+                StringView cur{str, strnlen(str, m.GetSize(i))};
+                if (!fun(cur, out) || out == cur) continue;
+                // truncating could split a multibyte character
+                if (out.size() > size)
+                {
+                    WARN << "Not replacing string " << j << '/' << i << ": "
+                         << out.size() << " bytes, only " << size
+                         << " fit" << std::endl;
+                    continue;
+                }
+                memmove(str, out.data(), out.size());
+                memset(str + out.size(), 0, size - out.size());
+            }
+            else
             {
-                index = j2;
-                return i;
+                auto& str = m.Get<OffsetString>(i);
+                if (!fun(str.Get(), out) || out == str.Get()) continue;
+                str.Set(out.to_string());
             }
+            ++count;
         }
+        ++j;
     }
-    return -1;
+    if (count) RecalcSize();
+    return count;
 }
 
-void Gbnl::ReadTxt_(std::istream& is)
+
+namespace
 {
-    std::string line, msg;
-    size_t last_index = 0, pos = -1;
 
-    while (is.good())
+std::string CsvTypeName(size_t idx, size_t size)
+{
+    switch (idx)
     {
-        std::getline(is, line);
+    case Gbnl::Struct::GetIndexFromType<uint8_t>():  return "uint8";
+    case Gbnl::Struct::GetIndexFromType<uint16_t>(): return "uint16";
+    case Gbnl::Struct::GetIndexFromType<uint32_t>(): return "uint32";
+    case Gbnl::Struct::GetIndexFromType<uint64_t>(): return "uint64";
+    case Gbnl::Struct::GetIndexFromType<float>():    return "float";
+    case Gbnl::Struct::GetIndexFromType<Gbnl::OffsetString>():
+        return "string";
+    case Gbnl::Struct::GetIndexFromType<Gbnl::FixStringTag>():
+        return "fixstring" + std::to_string(size);
+    }
+    NEPTOOLS_UNREACHABLE("Invalid csv column type");
+}
 
-        size_t offs;
-        if ((boost::algorithm::starts_with(line, SEP_DASH) && (offs = SEP_DASH.size())) ||
-            (boost::algorithm::starts_with(line, SEP_DASH_UTF8) && (offs = SEP_DASH_UTF8.size())))
+// Reads fields directly from the streambuf, without per field stream overhead
+class CsvReader
+{
+public:
+    CsvReader(std::istream& is, char sep) : sb{is.rdbuf()}, sep{sep} {}
+
+    bool Eof() const { return sb->sgetc() == EOF; }
+    size_t GetLine() const noexcept { return line; }
+
+    // Reads the next field into field. Returns false when it was the last
+    // field in its line.
+    bool Read()
+    {
+        field.clear();
+        quoted = false;
+        auto c = sb->sbumpc();
+        if (c == '"')
         {
-            if (pos != static_cast<size_t>(-1))
+            quoted = true;
+            while (true)
             {
-                NEPTOOLS_ASSERT(msg.empty() || msg.back() == '\n');
-                if (!msg.empty()) msg.pop_back();
-                auto& m = messages[last_index];
-                if (m.Is<OffsetString>(pos))
-                    m.Get<OffsetString>(pos).str = std::move(msg);
-                else
-                    strncpy(m.Get<FixStringTag>(pos).str, msg.c_str(),
-                            m.GetSize(pos)-1);
-                msg.clear();
+                c = sb->sbumpc();
+                if (c == EOF)
+                    NEPTOOLS_THROW(DecodeError{"GbnlCsv: unterminated quote"}
+                                   << Gbnl::FailedLine{line});
+                if (c == '"')
+                {
+                    if (sb->sgetc() != '"') break;
+                    sb->sbumpc();
+                }
+                else if (c == '\n')
+                    ++line;
+                field.push_back(c);
             }
+            c = sb->sbumpc();
+        }
+        else
+            for (; c != sep && c != '\n' && c != '\r' && c != EOF;
+                 c = sb->sbumpc())
+                field.push_back(c);
+
+        if (c == sep) return true;
+        if (c == '\r' && sb->sgetc() == '\n') c = sb->sbumpc();
+        if (c != '\n' && c != '\r' && c != EOF)
+            NEPTOOLS_THROW(DecodeError{"GbnlCsv: garbage after quoted field"}
+                           << Gbnl::FailedLine{line});
+        ++line;
+        return false;
+    }
 
-            if (line.compare(offs, 3, "EOF") == 0)
+    std::string field;
+    bool quoted;
+
+private:
+    std::streambuf* sb;
+    char sep;
+    size_t line = 1;
+};
+
+}
+
+void Gbnl::WriteCsv(std::ostream& os, char sep) const
+{
+    auto type = messages.GetRawType().get();
+    std::vector<size_t> cols;
+    for (size_t i = 0; i < type->item_count; ++i)
+        if (type->items[i].idx != Struct::GetIndexFromType<PaddingTag>())
+            cols.push_back(i);
+
+    std::string buf;
+    for (size_t i = 0; i < cols.size(); ++i)
+    {
+        if (i) buf.push_back(sep);
+        const auto& it = type->items[cols[i]];
+        buf.append(CsvTypeName(it.idx, it.size));
+    }
+    buf.push_back('\n');
+
+    for (auto m : messages)
+    {
+        for (size_t c = 0; c < cols.size(); ++c)
+        {
+            if (c) buf.push_back(sep);
+            auto i = cols[c];
+            switch (type->items[i].idx)
+            {
+            case Struct::GetIndexFromType<uint8_t>():
+                Csv::AppendUint(buf, m.Get<uint8_t>(i));
+                break;
+            case Struct::GetIndexFromType<uint16_t>():
+                Csv::AppendUint(buf, m.Get<uint16_t>(i));
+                break;
+            case Struct::GetIndexFromType<uint32_t>():
+                Csv::AppendUint(buf, m.Get<uint32_t>(i));
+                break;
+            case Struct::GetIndexFromType<uint64_t>():
+                Csv::AppendUint(buf, m.Get<uint64_t>(i));
+                break;
+            case Struct::GetIndexFromType<float>():
+                Csv::AppendFloat(buf, m.Get<float>(i));
+                break;
+            case Struct::GetIndexFromType<OffsetString>():
             {
-                RecalcSize();
-                return;
+                const auto& os = m.Get<OffsetString>(i);
+                if (os.offset != static_cast<uint32_t>(-1))
+                    Csv::AppendString(buf, os.Get(), sep, os.Get().empty());
+                break;
             }
-            uint32_t id = std::strtoul(line.data() + offs, nullptr, 10);
-            pos = FindDst(id, messages, last_index);
-            if (pos == static_cast<size_t>(-1))
+            case Struct::GetIndexFromType<FixStringTag>():
             {
-                NEPTOOLS_THROW(DecodeError{"GbnlTxt: invalid id in input"} <<
-                      FailedId{id});
+                // can fill the whole buffer without a terminator
+                auto str = m.Get<FixStringTag>(i).str;
+                Csv::AppendString(
+                    buf, {str, strnlen(str, m.GetSize(i))}, sep, false);
+                break;
+            }
             }
         }
-        else
+        buf.push_back('\n');
+
+        if (buf.size() >= 64*1024)
         {
-            if (pos == static_cast<size_t>(-1))
-                NEPTOOLS_THROW(DecodeError{"GbnlTxt: data before separator"});
-            if (!line.empty() && line.back() == '\r') line.pop_back();
-            msg.append(line).append(1, '\n');
+            os.write(buf.data(), buf.size());
+            buf.clear();
+        }
+    }
+    os.write(buf.data(), buf.size());
+}
+
+void Gbnl::ReadCsv(std::istream& is, char sep)
+{
+    auto type = messages.GetRawType().get();
+    std::vector<size_t> cols;
+    for (size_t i = 0; i < type->item_count; ++i)
+        if (type->items[i].idx != Struct::GetIndexFromType<PaddingTag>())
+            cols.push_back(i);
+    if (cols.empty())
+        NEPTOOLS_THROW(DecodeError{"GbnlCsv: no columns"});
+
+    CsvReader rd{is, sep};
+    auto error = [&](const char* msg)
+    { NEPTOOLS_THROW(DecodeError{msg} << FailedLine{rd.GetLine()}); };
+
+    for (size_t c = 0; c < cols.size(); ++c)
+    {
+        const auto& it = type->items[cols[c]];
+        if (rd.Read() != (c+1 < cols.size()))
+            error("GbnlCsv: invalid column count in header");
+        if (rd.field != CsvTypeName(it.idx, it.size))
+            error("GbnlCsv: column types don't match");
+    }
+
+    // modify a copy, so the messages are unchanged on error
+    Table tbl{messages};
+    size_t r = 0;
+    for (; !rd.Eof(); ++r)
+    {
+        if (r >= tbl.size()) tbl.emplace_back();
+        auto m = tbl[r];
+        for (size_t c = 0; c < cols.size(); ++c)
+        {
+            if (rd.Read() != (c+1 < cols.size()))
+                error("GbnlCsv: invalid column count");
+            auto i = cols[c];
+            uint64_t x = 0;
+            switch (type->items[i].idx)
+            {
+#define GBNL_CSV_UINT(T)                                          \
+            case Struct::GetIndexFromType<T>():                   \
+                if (!Csv::ParseUint(                              \
+                        rd.field, std::numeric_limits<T>::max(), x)) \
+                    error("GbnlCsv: invalid " #T);                \
+                m.Get<T>(i) = x;                                  \
+                break
+            GBNL_CSV_UINT(uint8_t);
+            GBNL_CSV_UINT(uint16_t);
+            GBNL_CSV_UINT(uint32_t);
+            GBNL_CSV_UINT(uint64_t);
+#undef GBNL_CSV_UINT
+
+            case Struct::GetIndexFromType<float>():
+            {
+                char* end;
+                m.Get<float>(i) = std::strtof(rd.field.c_str(), &end);
+                if (rd.field.empty() || *end)
+                    error("GbnlCsv: invalid float");
+                break;
+            }
+            case Struct::GetIndexFromType<OffsetString>():
+            {
+                auto& os = m.Get<OffsetString>(i);
+                if (rd.field.empty() && !rd.quoted)
+                {
+                    os.Set({});
+                    os.offset = -1;
+                }
+                else
+                {
+                    os.Set(std::move(rd.field));
+                    os.offset = 0; // recalculated by RecalcSize
+                }
+                break;
+            }
+            case Struct::GetIndexFromType<FixStringTag>():
+            {
+                auto size = type->items[i].size;
+                if (rd.field.size() >= size)
+                    error("GbnlCsv: fixstring too long");
+                auto str = m.Get<FixStringTag>(i).str;
+                memset(str, 0, size);
+                memcpy(str, rd.field.data(), rd.field.size());
+                break;
+            }
+            }
         }
     }
-    NEPTOOLS_THROW(DecodeError{"GbnlTxt: EOF"});
+    tbl.resize(r);
+
+    messages = std::move(tbl);
+    RecalcSize();
 }
 
 }
@@ -4,9 +4,11 @@
 
 #include "../dumpable.hpp"
 #include "../source.hpp"
-#include "../dynamic_struct.hpp"
+#include "../dynamic_table.hpp"
 #include "../txt_serializable.hpp"
 #include <boost/endian/arithmetic.hpp>
+#include <boost/optional.hpp>
+#include <memory>
 #include <vector>
 
 namespace Neptools
@@ -59,30 +61,150 @@ public:
 
 
     Gbnl(Source src);
+    // The validated header (at the beginning of GSTLs, at the end of GBNLs)
+    static Header ReadHeader(Source& src);
 
     void Fixup() override { RecalcSize(); }
 
-    struct OffsetString
+    // A string of the message string pool: either owned, or a view into the
+    // Source the Gbnl was parsed from, until it's changed through Set. The
+    // hash is cached for deduplication in RecalcSize.
+    class OffsetString
     {
+    public:
+        OffsetString() = default;
+        OffsetString(std::string str, uint32_t offset)
+            : offset{offset}, str{std::move(str)}, hash{Hash(this->str)} {}
+        // data must outlive the OffsetString
+        static OffsetString View(StringView data, uint32_t offset) noexcept
+        {
+            OffsetString ret;
+            ret.offset = offset;
+            ret.view = data.data();
+            ret.view_size = data.size();
+            ret.hash = Hash(data);
+            return ret;
+        }
+
+        StringView Get() const noexcept
+        { return view ? StringView{view, view_size} : StringView{str}; }
+        bool IsView() const noexcept { return view; }
+        // the string set through the constructor or Set, empty for views
+        const std::string& GetOwned() const noexcept { return str; }
+        void Set(std::string nstr)
+        {
+            str = std::move(nstr);
+            view = nullptr;
+            hash = Hash(str);
+        }
+        uint64_t GetHash() const noexcept { return hash; }
+
+        // FNV-1a
+        static constexpr uint64_t HASH_BASIS = 0xcbf29ce484222325;
+        static uint64_t Hash(StringView str) noexcept;
+
+        uint32_t offset = 0; // -1: null string
+
+    private:
         std::string str;
-        uint32_t offset;
+        const char* view = nullptr;
+        size_t view_size = 0;
+        uint64_t hash = HASH_BASIS;
     };
 
     struct FixStringTag { char str[1]; };
     struct PaddingTag { char pad[1]; };
-    using Struct = DynamicStruct<
+    using Table = DynamicTable<
         uint8_t, uint16_t, uint32_t, uint64_t, float, OffsetString,
         FixStringTag, PaddingTag>;
+    using Struct = Table::Struct;
+
+    // Converts rows between the file and the Table layout with a flat list of
+    // copy operations compiled once per type. On little-endian hosts the
+    // numbers need no conversion, and neighboring items merge into one copy.
+    class RowCodec
+    {
+    public:
+        RowCodec() = default;
+        explicit RowCodec(const Struct::Type& type);
+
+        // size of a row in the file
+        size_t GetRowSize() const noexcept { return row_size; }
+        // offset of an item in a file row
+        size_t GetFileOffset(size_t item) const noexcept
+        { return file_offsets[item]; }
+
+        // Decode count rows from src into dst[first], dst[first+1], ...
+        // except OffsetStrings, which are listed in GetStrings.
+        void Decode(const char* src, size_t count, Table& dst,
+                    size_t first) const;
+        // Encode count rows from src[first] into dst, OffsetStrings as their
+        // offset.
+        void Encode(const Table& src, size_t first, size_t count,
+                    char* dst) const;
+
+        struct String
+        {
+            size_t file_offset; // in the row
+            size_t item;
+        };
+        const std::vector<String>& GetStrings() const noexcept
+        { return strings; }
+
+    private:
+        enum class OpType : uint8_t
+        { COPY, COPY16, COPY32, COPY64, FIX_STRING, STRING };
+        struct Op
+        {
+            uint32_t file, mem, size;
+            OpType type;
+        };
+        std::vector<Op> decode_ops, encode_ops;
+        std::vector<String> strings;
+        std::vector<uint32_t> file_offsets;
+        size_t row_size = 0;
+    };
+
+    // The type and codec of a message layout, and the GetId special cases it
+    // needs. Files with the same type descriptors share one interned Layout.
+    struct Layout
+    {
+        explicit Layout(Struct::TypePtr type);
+
+        // thread safe
+        static std::shared_ptr<const Layout> Get(
+            const TypeDescriptor* descrs, size_t count, size_t msg_descr_size);
+        // number of distinct layouts in use
+        static size_t GetInternedCount();
+
+        Struct::TypePtr type;
+        RowCodec codec;
+        // GBNL: the txt id of this item is the uint32 item 0 (-1 if none)
+        size_t id_item = -1;
+        // GSTL: the txt ids are the uint32 item 1
+        bool gstl_ids = false;
+    };
 
     bool is_gstl;
     uint32_t flags, field_28, field_30;
-    std::vector<Struct> messages;
-    Struct::TypePtr type;
+    // one row per message, all of the same type
+    Table messages;
 
     void RecalcSize();
     FilePosition GetSize() const noexcept override;
 
+    // Every column except padding as comma (or tab) separated values, one
+    // message per line, with a header row of the column types: uint8,
+    // uint16, uint32, uint64, float, string or fixstring<size>. Null strings
+    // are empty fields, empty strings are "".
+    void WriteCsv(std::ostream& os, char sep = ',') const;
+    // The header must match the current types. The rows replace messages,
+    // padding is kept for the existing ones.
+    void ReadCsv(std::istream& is, char sep = ',');
+    void ReadCsv(std::istream&& is, char sep = ',') { ReadCsv(is, sep); }
+
     using FailedId = boost::error_info<struct FailedIdTag, uint32_t>;
+    using FailedLine = boost::error_info<struct FailedLineTag, size_t>;
 
 protected:
     // todo: private after removing GbnlItem
@@ -90,19 +212,25 @@ protected:
     void Inspect_(std::ostream& os) const override;
 
 private:
-    void WriteTxt_(std::ostream& os) const override;
-    void ReadTxt_(std::istream& is) override;
+    void WriteTxt_(TxtWriter& wr) const override;
+    void ReadTxt_(TxtReader& rd) override;
+    void ForEachString_(const StringFun& fun) const override;
+    size_t ReplaceStrings_(const ReplaceFun& fun) override;
 
     void Parse_(Source& src);
     void DumpHeader(Sink& sink) const;
-    void Pad(uint16_t diff, Struct::TypeBuilder& bld, bool& uint8_in_progress);
+    static void Pad(uint16_t diff, Struct::TypeBuilder& bld,
+                    bool& uint8_in_progress);
     FilePosition Align(FilePosition x) const noexcept;
 
-    uint32_t GetId(const Gbnl::Struct& m, size_t i, size_t j, size_t& k) const;
-    size_t FindDst(uint32_t id, std::vector<Gbnl::Struct>& messages,
-                   size_t& index) const;
+    uint32_t GetId(Table::ConstRow m, size_t i, size_t j, size_t& k) const;
+    class IdIndex;
 
+    std::shared_ptr<const Layout> layout;
+    // keeps the OffsetString views alive
+    boost::optional<Source> string_source;
     size_t msg_descr_size, msgs_size;
+    std::vector<size_t> string_items; // indices of OffsetString items
     size_t real_item_count; // excluding dummy pad items
 };
 
@@ -0,0 +1,440 @@
+#include "gbnl_query.hpp"
+#include "csv.hpp"
+#include "gbnl.hpp"
+#include "../except.hpp"
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#define NEPTOOLS_LOG_NAME "gbnl_query"
+#include "../logger_helper.hpp"
+
+namespace Neptools
+{
+
+namespace
+{
+
+class QueryParser
+{
+public:
+    explicit QueryParser(const std::string& str) : str{str} {}
+
+    void SkipSpace()
+    {
+        while (p < str.size() && isspace(static_cast<unsigned char>(str[p])))
+            ++p;
+    }
+    bool AtEnd() { SkipSpace(); return p == str.size(); }
+
+    // keyword followed by space or end (or '=', for cols)
+    bool Keyword(StringView kw)
+    {
+        SkipSpace();
+        if (str.compare(p, kw.size(), kw.data(), kw.size()) != 0) return false;
+        auto e = p + kw.size();
+        if (e < str.size() && isalnum(static_cast<unsigned char>(str[e])))
+            return false;
+        p = e;
+        return true;
+    }
+    bool Char(char c)
+    {
+        SkipSpace();
+        if (p < str.size() && str[p] == c) { ++p; return true; }
+        return false;
+    }
+
+    size_t Column()
+    {
+        SkipSpace();
+        auto b = p;
+        while (p < str.size() && isdigit(static_cast<unsigned char>(str[p])))
+            ++p;
+        uint64_t ret;
+        if (!Csv::ParseUint({str.data() + b, p - b}, 0xffff, ret))
+            Error("column number expected");
+        return ret;
+    }
+
+    std::string Value()
+    {
+        SkipSpace();
+        std::string ret;
+        if (p < str.size() && str[p] == '"')
+        {
+            for (++p; ; ++p)
+            {
+                if (p == str.size()) Error("unterminated quote");
+                if (str[p] == '"')
+                {
+                    if (p+1 < str.size() && str[p+1] == '"') ++p;
+                    else break;
+                }
+                ret.push_back(str[p]);
+            }
+            ++p;
+        }
+        else
+        {
+            auto b = p;
+            while (p < str.size() &&
+                   !isspace(static_cast<unsigned char>(str[p])))
+                ++p;
+            if (b == p) Error("value expected");
+            ret.assign(str, b, p - b);
+        }
+        return ret;
+    }
+
+    BOOST_NORETURN void Error(const char* msg)
+    {
+        NEPTOOLS_THROW(DecodeError{std::string{"GbnlQuery: "} + msg +
+                                   " at " + std::to_string(p)});
+    }
+
+private:
+    const std::string& str;
+    size_t p = 0;
+};
+
+// a cell of a file row
+struct Cell
+{
+    enum { UINT, FLOAT, STRING } kind;
+    uint64_t uint;
+    float num;
+    StringView str;
+    std::string buf; // for strings not in memory
+};
+
+struct FileInfo
+{
+    Source& src;
+    const char* resident;
+    const Gbnl::Header& head;
+    const Gbnl::Layout& layout;
+};
+
+template <typename T>
+uint64_t ReadLittle(const char* ptr)
+{
+    return *reinterpret_cast<const boost::endian::endian_arithmetic<
+        boost::endian::order::little, T, sizeof(T)*8,
+        boost::endian::align::no>*>(ptr);
+}
+
+void ReadCell(const FileInfo& fi, const char* row, size_t item, Cell& cell)
+{
+    const auto& it = fi.layout.type->items[item];
+    auto ptr = row + fi.layout.codec.GetFileOffset(item);
+    cell.kind = Cell::UINT;
+    switch (it.idx)
+    {
+    case Gbnl::Struct::GetIndexFromType<uint8_t>():
+        cell.uint = static_cast<uint8_t>(*ptr);
+        break;
+    case Gbnl::Struct::GetIndexFromType<uint16_t>():
+        cell.uint = ReadLittle<uint16_t>(ptr);
+        break;
+    case Gbnl::Struct::GetIndexFromType<uint32_t>():
+        cell.uint = ReadLittle<uint32_t>(ptr);
+        break;
+    case Gbnl::Struct::GetIndexFromType<uint64_t>():
+        cell.uint = ReadLittle<uint64_t>(ptr);
+        break;
+    case Gbnl::Struct::GetIndexFromType<float>():
+    {
+        uint32_t x = ReadLittle<uint32_t>(ptr);
+        cell.kind = Cell::FLOAT;
+        memcpy(&cell.num, &x, sizeof(float));
+        break;
+    }
+
+    case Gbnl::Struct::GetIndexFromType<Gbnl::OffsetString>():
+    {
+        cell.kind = Cell::STRING;
+        uint32_t offs = ReadLittle<uint32_t>(ptr);
+        if (offs == 0xffffffff)
+        {
+            cell.str = {};
+            break;
+        }
+
+        auto size = fi.src.GetSize();
+        if (offs >= size - fi.head.offset_msgs)
+            NEPTOOLS_THROW(DecodeError{"GbnlQuery: invalid string offset"});
+        auto pos = fi.head.offset_msgs + offs;
+        if (fi.resident)
+        {
+            auto len = strnlen(fi.resident + pos, size - pos);
+            if (pos + len >= size)
+                NEPTOOLS_THROW(DecodeError{"GbnlQuery: unterminated string"});
+            cell.str = {fi.resident + pos, len};
+        }
+        else
+        {
+            cell.buf = fi.src.PreadCString(pos);
+            cell.str = cell.buf;
+        }
+        break;
+    }
+    case Gbnl::Struct::GetIndexFromType<Gbnl::FixStringTag>():
+        cell.kind = Cell::STRING;
+        cell.str = {ptr, strnlen(ptr, it.size)};
+        break;
+    }
+}
+
+template <typename T>
+int Compare(const T& a, const T& b) { return (b < a) - (a < b); }
+
+}
+
+GbnlQuery::GbnlQuery(const std::string& query)
+{
+    QueryParser p{query};
+    if (p.Keyword("cols"))
+    {
+        if (!p.Char('=')) p.Error("'=' expected");
+        do
+        {
+            cols.push_back(p.Column());
+            max_col = std::max(max_col, cols.back() + 1);
+        }
+        while (p.Char(','));
+    }
+
+    if (p.Keyword("where"))
+        do
+        {
+            Cond c;
+            c.col = p.Column();
+            max_col = std::max(max_col, c.col + 1);
+            if (p.Char('=')) c.op = Op::EQ;
+            else if (p.Char('!'))
+            {
+                if (!p.Char('=')) p.Error("'!=' expected");
+                c.op = Op::NE;
+            }
+            else if (p.Char('<')) c.op = p.Char('=') ? Op::LE : Op::LT;
+            else if (p.Char('>')) c.op = p.Char('=') ? Op::GE : Op::GT;
+            else p.Error("operator expected");
+
+            c.str = p.Value();
+            c.is_uint = Csv::ParseUint(c.str, -1, c.uint);
+            char* end;
+            c.num = strtod(c.str.c_str(), &end);
+            if (*end) c.num = std::numeric_limits<double>::quiet_NaN();
+            conds.push_back(std::move(c));
+        }
+        while (p.Keyword("and"));
+
+    if (!p.AtEnd()) p.Error("garbage at end of query");
+}
+
+bool GbnlQuery::Run(Source src, StringView name, std::string& out) const
+{
+    auto head = Gbnl::ReadHeader(src);
+    std::vector<Gbnl::TypeDescriptor> descrs(head.count_types);
+    src.Pread(head.offset_types, reinterpret_cast<char*>(descrs.data()),
+              descrs.size() * sizeof(Gbnl::TypeDescriptor));
+    auto layout = Gbnl::Layout::Get(
+        descrs.data(), descrs.size(), head.msg_descr_size);
+
+    // column -> item
+    const auto& type = *layout->type;
+    std::vector<size_t> items;
+    for (size_t i = 0; i < type.item_count; ++i)
+        if (type.items[i].idx !=
+            Gbnl::Struct::GetIndexFromType<Gbnl::PaddingTag>())
+            items.push_back(i);
+    if (items.size() < max_col) return false;
+
+    std::vector<size_t> sel_items;
+    if (cols.empty()) sel_items = items;
+    else
+        for (auto c : cols) sel_items.push_back(items[c]);
+
+    FileInfo fi{src, src.GetResidentData(), head, *layout};
+    auto row_size = head.msg_descr_size;
+    std::unique_ptr<char[]> row_buf;
+    if (!fi.resident) row_buf.reset(new char[row_size]);
+
+    Cell cell;
+    for (size_t r = 0; r < head.count_msgs; ++r)
+    {
+        auto offs = head.descr_offset + r * row_size;
+        const char* row;
+        if (fi.resident)
+            row = fi.resident + offs;
+        else
+        {
+            src.Pread(offs, row_buf.get(), row_size);
+            row = row_buf.get();
+        }
+
+        bool match = true;
+        for (const auto& c : conds)
+        {
+            ReadCell(fi, row, items[c.col], cell);
+            int cmp = 0;
+            switch (cell.kind)
+            {
+            case Cell::UINT:
+                cmp = c.is_uint ? Compare(cell.uint, c.uint) :
+                    Compare<double>(cell.uint, c.num);
+                break;
+            case Cell::FLOAT:
+                cmp = Compare<double>(cell.num, c.num);
+                break;
+            case Cell::STRING:
+                cmp = cell.str.compare(c.str);
+                break;
+            }
+            // comparisons with NaN (or a non-number) are false, except !=
+            if (cell.kind != Cell::STRING && c.num != c.num && !c.is_uint)
+                match = c.op == Op::NE;
+            else
+                switch (c.op)
+                {
+                case Op::EQ: match = cmp == 0; break;
+                case Op::NE: match = cmp != 0; break;
+                case Op::LT: match = cmp < 0;  break;
+                case Op::GT: match = cmp > 0;  break;
+                case Op::LE: match = cmp <= 0; break;
+                case Op::GE: match = cmp >= 0; break;
+                }
+            if (!match) break;
+        }
+        if (!match) continue;
+
+        out.append(name.data(), name.size());
+        out.push_back('\t');
+        Csv::AppendUint(out, r);
+        for (auto i : sel_items)
+        {
+            out.push_back('\t');
+            ReadCell(fi, row, i, cell);
+            switch (cell.kind)
+            {
+            case Cell::UINT:   Csv::AppendUint(out, cell.uint);  break;
+            case Cell::FLOAT:  Csv::AppendFloat(out, cell.num);  break;
+            case Cell::STRING:
+                Csv::AppendString(out, cell.str, '\t', false);
+                break;
+            }
+        }
+        out.push_back('\n');
+    }
+    return true;
+}
+
+bool GbnlQuery::Run(const std::vector<boost::filesystem::path>& files,
+                    std::ostream& os, unsigned threads) const
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, files.size());
+
+    // the logger isn't thread safe, so the workers don't log: files are
+    // opened (Source::FromFile can warn) and errors are reported here, at
+    // most window files ahead of the output
+    struct Result
+    {
+        boost::optional<Source> src;
+        std::string out, error;
+        bool missing = false, done = false;
+    };
+    std::vector<Result> results(files.size());
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t next = 0, opened = 0;
+    size_t window = 2 * threads;
+
+    auto worker = [&]()
+    {
+        while (true)
+        {
+            size_t i;
+            boost::optional<Source> src;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                cv.wait(lock, [&]()
+                        { return next < opened || next == files.size(); });
+                if (next == files.size()) return;
+                i = next++;
+                src = std::move(results[i].src);
+            }
+            if (!src) continue; // failed to open
+
+            std::string out, error;
+            bool missing = false;
+            try { missing = !Run(std::move(*src), files[i].string(), out); }
+            catch (...)
+            {
+                out.clear();
+                error = ExceptionToString();
+            }
+
+            std::lock_guard<std::mutex> lock{mutex};
+            results[i].out = std::move(out);
+            results[i].error = std::move(error);
+            results[i].missing = missing;
+            results[i].done = true;
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) workers.emplace_back(worker);
+
+    bool failed = false;
+    size_t to_open = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        for (; to_open < std::min(files.size(), i + window); ++to_open)
+        {
+            boost::optional<Source> src;
+            std::string error;
+            try { src = Source::FromFile(files[to_open]); }
+            catch (...) { error = ExceptionToString(); }
+
+            std::lock_guard<std::mutex> lock{mutex};
+            auto& r = results[to_open];
+            r.src = std::move(src);
+            r.error = std::move(error);
+            r.done = !r.src;
+            opened = to_open + 1;
+            cv.notify_all();
+        }
+
+        Result r;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [&]() { return results[i].done; });
+            r = std::move(results[i]);
+        }
+        if (!r.error.empty())
+        {
+            failed = true;
+            ERR << files[i] << ": " << r.error << std::endl;
+        }
+        else if (r.missing)
+            DBG(1) << files[i] << ": missing columns" << std::endl;
+        os.write(r.out.data(), r.out.size());
+    }
+
+    for (auto& w : workers) w.join();
+    return !failed;
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef UUID_873C2304_75F8_489A_94D6_AE7DBE898601
+#define UUID_873C2304_75F8_489A_94D6_AE7DBE898601
+#pragma once
+
+#include "../source.hpp"
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+namespace Neptools
+{
+
+// Selects columns of the rows of GBNL files without parsing them into a Gbnl:
+// only the header, the type descriptors and the needed cells are read.
+// Columns are numbered like in Gbnl::WriteCsv (padding is not a column):
+//   cols=0,5 where 0>100 and 5!="foo bar"
+// Without cols every column is selected, without where every row. Number
+// columns compare numerically, strings lexicographically (null strings are
+// empty).
+class GbnlQuery
+{
+public:
+    explicit GbnlQuery(const std::string& query);
+
+    // Appends a "name<TAB>row<TAB>columns..." line to out for every matching
+    // row of src. Returns false if src doesn't have the needed columns.
+    bool Run(Source src, StringView name, std::string& out) const;
+
+    // Runs on every file with threads workers (0: one per cpu), writing the
+    // results to os in file order as they become ready. Files without the
+    // needed columns are skipped. Returns false if a file failed. Errors are
+    // logged from the calling thread, in file order.
+    bool Run(const std::vector<boost::filesystem::path>& files,
+             std::ostream& os, unsigned threads = 0) const;
+
+private:
+    enum class Op { EQ, NE, LT, GT, LE, GE };
+    struct Cond
+    {
+        size_t col;
+        Op op;
+        std::string str;
+        bool is_uint;
+        uint64_t uint;
+        double num;
+    };
+    std::vector<size_t> cols; // empty: every column
+    std::vector<Cond> conds;
+    size_t max_col = 0; // largest column used + 1
+};
+
+}
+#endif
@@ -32,6 +32,35 @@ void Item::UpdatePosition(FilePosition npos)
 {
     position = npos;
     Fixup();
+    dirty = false;
+}
+
+void Item::SizeChanged(FilePosition old_size, FilePosition new_size) noexcept
+{
+    dirty = true;
+    if (parent) parent->UpdateSize(new_size, old_size);
+}
+
+void Item::InvalidateSize() noexcept
+{
+    dirty = true;
+    for (auto p = parent; p && (!p->dirty || p->size_valid); p = p->parent)
+    {
+        p->dirty = true;
+        p->size_valid = false;
+    }
+}
+
+void Item::PrepareModify()
+{
+    auto& ctx = GetUnsafeContext();
+    if (ctx.snapshots.empty() || saved_generation == ctx.snapshot_generation)
+        return;
+
+    saved_generation = ctx.snapshot_generation;
+    if (auto fun = SaveState())
+        ctx.undo_log.push_back(
+            {MakeNotNull(SmartPtr<Item>{this}), std::move(fun)});
 }
 
 void Item::Replace(NotNull<SmartPtr<Item>> nitem) noexcept
@@ -137,6 +166,18 @@ std::ostream& operator<<(std::ostream& os, const Item& item)
     return os;
 }
 
+// the context if item is part of its tree (without dereferencing the
+// context otherwise, it might be already freed)
+static Context* GetTreeContext(Item& item, Context* ctx) noexcept
+{
+    if (!ctx) return nullptr;
+    Item* p = &item;
+    while (p->GetParent()) p = p->GetParent();
+    if (p->GetKind() == ItemKind::CONTEXT && static_cast<Context*>(p) == ctx)
+        return ctx;
+    return nullptr;
+}
+
 void ItemListTraits::add(ItemList& list, Item& it) noexcept
 {
     auto& self = static_cast<ItemWithChildren&>(list);
@@ -145,14 +186,23 @@ void ItemListTraits::add(ItemList& list, Item& it) noexcept
     // not in list: checked by boost::intrusive (but parent check should do it too)
     it.parent = &self;
     it.AddRef();
+    self.UpdateSize(self.size_valid ? it.GetSize() : 0, 0);
+
+    auto ctx = GetTreeContext(self, it.context.GetPtr());
+    if (ctx && !ctx->tracked.empty()) ctx->TrackAdd(it);
 }
 
 void ItemListTraits::remove(ItemList& list, Item& it) noexcept
 {
     // GetPtr: it might be called from the parent's destructor, and the weak ptr
     // is expired by then
-    NEPTOOLS_ASSERT_MSG(it.parent == static_cast<ItemWithChildren*>(&list),
-                        "item is added to a different list");
+    auto& self = static_cast<ItemWithChildren&>(list);
+    NEPTOOLS_ASSERT_MSG(it.parent == &self, "item is added to a different list");
+    auto ctx = GetTreeContext(self, it.context.GetPtr());
+    if (ctx && !ctx->tracked.empty()) ctx->TrackRemove(it);
+
+    // only query the size if needed (also called during Dispose)
+    self.UpdateSize(0, self.size_valid ? it.GetSize() : 0);
     it.parent = nullptr;
     it.RemoveRef();
 }
@@ -176,18 +226,42 @@ void ItemWithChildren::Inspect_(std::ostream& os) const
 
 FilePosition ItemWithChildren::GetSize() const
 {
+    if (size_valid) return cached_size;
+
     FilePosition ret = 0;
     for (auto& c : GetChildren())
         ret += c.GetSize();
+    cached_size = ret;
+    size_valid = true;
     return ret;
 }
 
+void ItemWithChildren::UpdateSize(
+    FilePosition added, FilePosition removed) noexcept
+{
+    for (auto it = this; it; it = it->parent)
+    {
+        it->dirty = true;
+        if (it->size_valid)
+            it->cached_size = it->cached_size + added - removed;
+    }
+}
+
 void ItemWithChildren::Fixup_(FilePosition offset)
 {
     FilePosition pos = position + offset;
     for (auto& c : GetChildren())
     {
-        c.UpdatePosition(pos);
+        // unchanged items before the first modification can be skipped
+        if (c.dirty || c.position != pos)
+        {
+            auto old_size = c.GetSize();
+            c.UpdatePosition(pos);
+            // fixup can change the size (e.g. gbnl string table)
+            if (c.GetSize() != old_size)
+                for (auto it = this; it; it = it->parent)
+                    it->size_valid = false;
+        }
         pos += c.GetSize();
     }
 }
@@ -196,7 +270,7 @@ void ItemWithChildren::MoveNextToChild(size_t size) noexcept
 {
     auto& list = parent->GetChildren();
     // make sure we have a ref when erasing...
-    SmartPtr<Item> nchild = &asserted_cast<RawItem&>(
+    SmartPtr<Item> nchild = &AssertedCast<RawItem>(
         *++Iterator()).Split(0, size);
     list.erase(nchild->Iterator());
     GetChildren().push_back(*nchild);
@@ -7,7 +7,9 @@
 #include "../shared_ptr.hpp"
 #include "../container/list.hpp"
 
+#include <functional>
 #include <iosfwd>
+#include <typeinfo>
 #include <vector>
 #include <map>
 #include <boost/intrusive/set.hpp>
@@ -22,14 +24,14 @@ class Item : public RefCounted, public Dumpable,
              public boost::intrusive::list_base_hook<LinkMode>
 {
 protected:
-    struct Key {};
+    struct Key { ItemKind kind; };
 public:
     // do not change Context* to Weak/Shared ptr
     // otherwise Context's constructor will try to construct a WeakPtr before
     // RefCounted's constructor is finished, making an off-by-one error and
     // freeing the context twice
-    explicit Item(Key, Context* ctx, FilePosition position = 0) noexcept
-        : position{position}, context{ctx} {}
+    explicit Item(Key k, Context* ctx, FilePosition position = 0) noexcept
+        : position{position}, context{ctx}, kind{k.kind} {}
     Item(const Item&) = delete;
     void operator=(const Item&) = delete;
     virtual ~Item();
@@ -48,6 +50,17 @@ public:
     auto Iterator() noexcept;
 
     FilePosition GetPosition() const noexcept { return position; }
+    ItemKind GetKind() const noexcept { return kind; }
+
+    // Call it after modifying the item in a way that might change its size.
+    // Parents cache their sizes and Fixup skips items that weren't changed
+    // (and weren't moved) since the last Fixup. Adding or removing children
+    // is tracked automatically.
+    void InvalidateSize() noexcept;
+
+    // Call it before modifying the item's contents, this saves its state if
+    // there's an active snapshot (see Context::TakeSnapshot)
+    void PrepareModify();
 
     // requires: has valid parent
     void Replace(NotNull<RefCountedPtr<Item>> nitem) noexcept;
@@ -65,8 +78,13 @@ public:
 
 protected:
     void UpdatePosition(FilePosition npos);
+    // like InvalidateSize, when the change is known (and the item is in a tree)
+    void SizeChanged(FilePosition old_size, FilePosition new_size) noexcept;
 
     void Inspect_(std::ostream& os) const override = 0;
+    // return a function that restores the current state of the item (called
+    // by PrepareModify). Only items modified after parsing need it.
+    virtual std::function<void ()> SaveState() { return {}; }
 
     using SlicePair = std::pair<NotNull<RefCountedPtr<Item>>, FilePosition>;
     using SliceSeq = std::vector<SlicePair>;
@@ -77,6 +95,11 @@ protected:
 private:
     WeakRefCountedPtr<Context> context;
     ItemWithChildren* parent = nullptr;
+    const ItemKind kind;
+    // needs fixup. if an item is dirty, so are its parents
+    bool dirty = true;
+    // Context::snapshot_generation when last saved by PrepareModify
+    uint32_t saved_generation = 0;
 
     LabelsContainer labels;
 
@@ -124,8 +147,83 @@ protected:
     void Inspect_(std::ostream& sink) const override;
     void Fixup_(FilePosition offset);
 
+private:
+    void UpdateSize(FilePosition added, FilePosition removed) noexcept;
+
+    // sum of children sizes. if valid, the children's caches are valid too
+    mutable FilePosition cached_size;
+    mutable bool size_valid = false;
+
+    friend class Item;
+    friend class Context;
     friend struct ::Neptools::ItemListTraits;
 };
 
+namespace Detail
+{
+// Subclasses inheriting KIND can't be told apart from their base, so only
+// the class declaring it (as KindOwner) can be a cast target. Use
+// dynamic_cast for the others.
+template <typename T>
+struct ItemKindCheck
+{
+    static_assert(std::is_same<typename T::KindOwner, T>::value,
+                  "T doesn't have its own ItemKind");
+    static bool Is(ItemKind k) noexcept { return k == T::KIND; }
+};
+
+template <>
+struct ItemKindCheck<Item>
+{ static bool Is(ItemKind) noexcept { return true; } };
+
+template <>
+struct ItemKindCheck<ItemWithChildren>
+{
+    static bool Is(ItemKind k) noexcept
+    { return k >= ItemKind::WITH_CHILDREN_BEGIN; }
+};
+}
+
+template <typename T, typename U>
+inline T* MaybeCast(U* item) noexcept
+{
+    if (item && Detail::ItemKindCheck<std::remove_const_t<T>>::Is(
+            item->GetKind()))
+        return static_cast<T*>(item);
+    return nullptr;
+}
+
+template <typename T, typename U>
+inline T& CheckedCast(U& item)
+{
+    if (!Detail::ItemKindCheck<std::remove_const_t<T>>::Is(item.GetKind()))
+        throw std::bad_cast{};
+    return static_cast<T&>(item);
+}
+
+template <typename T, typename U>
+inline T& AssertedCast(U& item) noexcept
+{
+    NEPTOOLS_ASSERT_MSG(
+        Detail::ItemKindCheck<std::remove_const_t<T>>::Is(item.GetKind()),
+        "U is not T");
+    return static_cast<T&>(item);
+}
+
+// Call fun with every T in the tree starting at root (root included), in
+// file order
+template <typename T, typename U, typename Fun>
+void ForEachItem(U& root, Fun&& fun)
+{
+    using TT = std::conditional_t<std::is_const<U>::value, const T, T>;
+    using Children = std::conditional_t<
+        std::is_const<U>::value, const ItemWithChildren, ItemWithChildren>;
+
+    if (auto x = MaybeCast<TT>(&root)) fun(*x);
+    if (auto ch = MaybeCast<Children>(&root))
+        for (auto& c : ch->GetChildren())
+            ForEachItem<T>(c, fun);
+}
+
 }
 #endif
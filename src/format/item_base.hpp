@@ -16,6 +16,34 @@ namespace Neptools
 class Item;
 class Context;
 
+// Type tag of items, set on construction. Items with children must come after
+// WITH_CHILDREN_BEGIN.
+enum class ItemKind : uint8_t
+{
+    RAW,
+    EOF_ITEM,
+
+    STCM_HEADER,
+    STCM_EXPORTS,
+    STCM_COLLECTION_LINK_HEADER,
+    STCM_COLLECTION_LINK,
+    STCM_GBNL,
+
+    STSC_HEADER,
+    STSC_INSTRUCTION,
+    STSC_STRING,
+
+    WITH_CHILDREN_BEGIN,
+    CONTEXT = WITH_CHILDREN_BEGIN,
+    STCM_INSTRUCTION,
+    STCM_DATA,
+};
+
+// dynamic_cast replacements using ItemKind, defined in item.hpp
+template <typename T, typename U> T* MaybeCast(U* item) noexcept;
+template <typename T, typename U> T& CheckedCast(U& item);
+template <typename T, typename U> T& AssertedCast(U& item) noexcept;
+
 struct ItemPointer
 {
     Item* item;
@@ -32,33 +60,33 @@ struct ItemPointer
     Item* operator->() const { return item; }
 
     template <typename T>
-    T& As() const { return *asserted_cast<T*>(item); }
+    T& As() const { return AssertedCast<T>(*item); }
 
     template <typename T>
-    T& AsChecked() const { return dynamic_cast<T&>(*item); }
+    T& AsChecked() const { return CheckedCast<T>(*item); }
 
     template <typename T>
-    T* Maybe() const { return dynamic_cast<T*>(item); }
+    T* Maybe() const { return MaybeCast<T>(item); }
 
     template <typename T>
     T& As0() const
     {
         NEPTOOLS_ASSERT(offset == 0);
-        return *asserted_cast<T*>(item);
+        return AssertedCast<T>(*item);
     }
 
     template <typename T>
     T& AsChecked0() const
     {
         NEPTOOLS_ASSERT(offset == 0);
-        return dynamic_cast<T&>(*item);
+        return CheckedCast<T>(*item);
     }
 
     template <typename T>
     T* Maybe0() const
     {
         NEPTOOLS_ASSERT(offset == 0);
-        return dynamic_cast<T*>(item);
+        return MaybeCast<T>(item);
     }
 };
 
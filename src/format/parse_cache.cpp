@@ -0,0 +1,369 @@
+#include "parse_cache.hpp"
+#include "context.hpp"
+#include "eof_item.hpp"
+#include "raw_item.hpp"
+#include "../except.hpp"
+#include "../sink.hpp"
+
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include <boost/filesystem/operations.hpp>
+
+#define NEPTOOLS_LOG_NAME "parse_cache"
+#include "../logger_helper.hpp"
+
+namespace Neptools
+{
+
+// increase when a parser changes what items it creates or where
+static constexpr uint32_t VERSION = 1;
+static constexpr uint32_t NO_INDEX = -1;
+
+static boost::filesystem::path directory;
+
+void ParseCache::Header::Validate(
+    const char* exp_format, uint64_t exp_hash, FilePosition exp_source_size,
+    FilePosition file_size) const
+{
+#define VALIDATE(x) NEPTOOLS_VALIDATE_FIELD("ParseCache::Header", x)
+    VALIDATE(memcmp(magic, "NEPCACHE", 8) == 0);
+    VALIDATE(version == VERSION);
+    VALIDATE(memcmp(format, exp_format, 4) == 0);
+    VALIDATE(hash == exp_hash);
+    VALIDATE(source_size == exp_source_size);
+    VALIDATE(created_count <= item_count);
+    VALIDATE(sizeof(Header) + uint64_t(item_count) * sizeof(ItemEntry) +
+             uint64_t(created_count) * 4 + uint64_t(label_count) * 5
+             <= file_size);
+#undef VALIDATE
+}
+
+static uint64_t HashSource(const Source& src)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    char buf[64*1024];
+    for (FilePosition pos = 0, size = src.GetSize(); pos < size; )
+    {
+        auto len = std::min<FilePosition>(size - pos, sizeof(buf));
+        src.Pread(pos, buf, len);
+        for (size_t i = 0; i < len; ++i)
+            hash = (hash ^ static_cast<Byte>(buf[i])) * 0x100000001b3;
+        pos += len;
+    }
+    return hash;
+}
+
+static bool IsWithChildren(uint8_t kind)
+{ return kind >= static_cast<uint8_t>(ItemKind::WITH_CHILDREN_BEGIN); }
+
+static bool IsCreated(uint8_t kind)
+{
+    return kind != static_cast<uint8_t>(ItemKind::RAW) &&
+        kind != static_cast<uint8_t>(ItemKind::EOF_ITEM);
+}
+
+ParseCache::ParseCache(Context& ctx, const Source& src, const char* format,
+                       uint32_t variant)
+    : ctx{ctx}, src{src}, format{format}, variant{variant}
+{
+    NEPTOOLS_ASSERT(strlen(format) == 4);
+}
+
+ParseCache::~ParseCache()
+{
+    if (recording) ctx.created_items = nullptr;
+}
+
+void ParseCache::SetDirectory(boost::filesystem::path dir)
+{ directory = std::move(dir); }
+
+const boost::filesystem::path& ParseCache::GetDirectory() noexcept
+{ return directory; }
+
+boost::filesystem::path ParseCache::GetPath() const
+{
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash << '-'
+       << src.GetSize() << '.' << format;
+    return directory / ss.str();
+}
+
+bool ParseCache::Restore(CreateFun create)
+{
+    if (directory.empty()) return false;
+
+    hash = HashSource(src);
+    // variant 0 leaves the hash unchanged
+    if (variant) hash = (hash ^ variant) * 0x100000001b3;
+    auto path = GetPath();
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(path, ec))
+    {
+        try
+        {
+            Restore_(Source::FromFile(path), create);
+            DBG(1) << "Restored " << src.GetFileName() << " from " << path
+                   << std::endl;
+            return true;
+        }
+        catch (const std::exception&)
+        {
+            WARN << "Ignoring parse cache " << path << ": "
+                 << ExceptionToString() << std::endl;
+            ctx.Clear();
+        }
+    }
+
+    recording = true;
+    ctx.created_items = &created;
+    return false;
+}
+
+void ParseCache::Restore_(const Source& cache_src, CreateFun create)
+{
+    Source cache{cache_src};
+    cache.CheckSize(sizeof(Header));
+    auto hdr = cache.ReadGen<Header>();
+    hdr.Validate(format, hash, src.GetSize(), cache.GetSize());
+
+    std::vector<ItemEntry> entries(hdr.item_count);
+    cache.Read(reinterpret_cast<Byte*>(entries.data()),
+               entries.size() * sizeof(ItemEntry));
+
+#define VALIDATE(x) NEPTOOLS_VALIDATE_FIELD("ParseCache::ItemEntry", x)
+    // entries must tile the file: every byte belongs to exactly one leaf or
+    // to the header part of one item with children (the part before its
+    // first child)
+    auto n = entries.size();
+    auto end_of = [&](size_t i)
+    { return FilePosition(entries[i].position) + entries[i].size; };
+    std::vector<FilePosition> part_size(n);
+    std::vector<uint32_t> parent(n);
+    std::vector<uint32_t> open;
+    FilePosition pos = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const auto& e = entries[i];
+        while (!open.empty() && end_of(open.back()) == pos) open.pop_back();
+
+        VALIDATE(e.depth == open.size());
+        VALIDATE(e.position == pos);
+        auto end = end_of(i);
+        VALIDATE(end <= src.GetSize());
+        parent[i] = open.empty() ? NO_INDEX : open.back();
+
+        if (IsWithChildren(e.kind))
+        {
+            if (i+1 < n && entries[i+1].depth > e.depth)
+            {
+                VALIDATE(entries[i+1].position > e.position &&
+                         entries[i+1].position < end);
+                part_size[i] = entries[i+1].position - e.position;
+                open.push_back(i);
+            }
+            else
+            {
+                VALIDATE(e.size > 0);
+                part_size[i] = e.size;
+            }
+        }
+        else
+        {
+            VALIDATE(e.kind != static_cast<uint8_t>(ItemKind::EOF_ITEM) ||
+                     e.size == 0);
+            // only allow one empty item at the end: pmap can't store more
+            VALIDATE(e.size > 0 || i == n-1);
+            part_size[i] = e.size;
+        }
+        pos += part_size[i];
+        if (parent[i] != NO_INDEX)
+            VALIDATE(end <= end_of(parent[i]));
+    }
+    while (!open.empty() && end_of(open.back()) == pos) open.pop_back();
+    VALIDATE(open.empty() && pos == src.GetSize());
+#undef VALIDATE
+
+#define VALIDATE(x) NEPTOOLS_VALIDATE_FIELD("ParseCache::Created", x)
+    std::vector<uint32_t> created_idx(hdr.created_count);
+    std::vector<uint32_t> rank(n, NO_INDEX);
+    for (uint32_t i = 0; i < hdr.created_count; ++i)
+    {
+        auto idx = created_idx[i] = cache.ReadLittleUint32();
+        VALIDATE(idx < n && IsCreated(entries[idx].kind) &&
+                 rank[idx] == NO_INDEX);
+        rank[idx] = i;
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        VALIDATE(IsCreated(entries[i].kind) == (rank[i] != NO_INDEX));
+        // children are moved into their parent when it's created
+        if (parent[i] != NO_INDEX && rank[i] != NO_INDEX)
+            VALIDATE(rank[i] > rank[parent[i]]);
+    }
+#undef VALIDATE
+
+    // placeholders: the final RawItems and EofItem, temporary RawItems for the
+    // rest
+    std::vector<NotNull<SmartPtr<Item>>> items;
+    items.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        FilePosition ipos = entries[i].position;
+        SmartPtr<Item> it;
+        if (part_size[i] == 0)
+            it = ctx.Create<EofItem>(ipos);
+        else
+            it = ctx.Create<RawItem>(Source{src, ipos, part_size[i]}, ipos);
+        ctx.GetChildren().push_back(*it);
+        ctx.pmap.emplace_hint(ctx.pmap.end(), ipos, it.get());
+        items.emplace_back(std::move(it));
+    }
+
+    // create items in the original order, so labels get the same names
+    for (auto i : created_idx)
+    {
+        const auto& e = entries[i];
+        auto kind = static_cast<ItemKind>(static_cast<uint8_t>(e.kind));
+        auto nitem = create(
+            ctx, kind, Source{src, e.position, src.GetSize() - e.position},
+            e.size);
+        if (nitem->GetKind() != kind || nitem->GetSize() != part_size[i])
+            NEPTOOLS_THROW(DecodeError{"ParseCache: item mismatch"});
+
+        items[i]->Replace(nitem);
+        items[i] = nitem;
+
+        if (auto ch = MaybeCast<ItemWithChildren>(nitem.get()))
+            for (size_t j = i+1; j < n && entries[j].depth > e.depth; ++j)
+                if (entries[j].depth == e.depth + 1)
+                {
+                    auto& c = *items[j];
+                    c.GetParent()->GetChildren().erase(c.Iterator());
+                    ch->GetChildren().push_back(c);
+                }
+    }
+
+    // labels are created by the item constructors, they must match
+    auto it = ctx.labels.begin();
+    for (uint32_t i = 0; i < hdr.label_count; ++i, ++it)
+    {
+        auto lpos = cache.ReadLittleUint32();
+        auto name = cache.ReadCString();
+        if (it == ctx.labels.end() || it->name != name ||
+            ToFilePos(it->ptr) != lpos)
+            NEPTOOLS_THROW(DecodeError{"ParseCache: label mismatch"}
+                           << AffectedLabel{std::move(name)});
+    }
+    if (it != ctx.labels.end())
+        NEPTOOLS_THROW(DecodeError{"ParseCache: label mismatch"}
+                       << AffectedLabel{it->name});
+}
+
+void ParseCache::Store() noexcept
+{
+    if (!recording) return;
+    ctx.created_items = nullptr;
+    recording = false;
+
+    try { Store_(); }
+    catch (const std::exception&)
+    {
+        WARN << "Failed to write parse cache: " << ExceptionToString()
+             << std::endl;
+    }
+}
+
+namespace
+{
+struct Collector
+{
+    std::vector<ParseCache::ItemEntry> entries;
+    std::unordered_map<const Item*, uint32_t> index;
+
+    void Collect(const ItemWithChildren& parent, unsigned depth)
+    {
+        if (depth > 0xff)
+            NEPTOOLS_THROW(std::runtime_error{"ParseCache: too deep tree"});
+        for (auto& c : parent.GetChildren())
+        {
+            index[&c] = entries.size();
+            entries.push_back({});
+            auto& e = entries.back();
+            e.kind = static_cast<uint8_t>(c.GetKind());
+            e.depth = depth;
+            e.field_02 = 0;
+            e.position = c.GetPosition();
+            e.size = c.GetSize();
+
+            if (auto ch = MaybeCast<const ItemWithChildren>(&c))
+                Collect(*ch, depth+1);
+        }
+    }
+};
+}
+
+void ParseCache::Store_()
+{
+    if (src.GetSize() > std::numeric_limits<uint32_t>::max())
+        NEPTOOLS_THROW(std::runtime_error{"ParseCache: file too big"});
+
+    Collector col;
+    col.Collect(ctx, 0);
+
+    std::vector<uint32_t> created_idx;
+    created_idx.reserve(created.size());
+    for (auto it : created)
+    {
+        auto x = col.index.find(it);
+        if (x == col.index.end())
+            NEPTOOLS_THROW(std::runtime_error{
+                "ParseCache: created item not in tree"});
+        created_idx.push_back(x->second);
+    }
+
+    FilePosition size = sizeof(Header) +
+        col.entries.size() * sizeof(ItemEntry) + created_idx.size() * 4;
+    uint32_t label_count = 0;
+    for (auto& l : ctx.labels)
+    {
+        size += 4 + l.name.size() + 1;
+        ++label_count;
+    }
+
+    Header hdr;
+    memcpy(hdr.magic, "NEPCACHE", 8);
+    hdr.version = VERSION;
+    memcpy(hdr.format, format, 4);
+    hdr.hash = hash;
+    hdr.source_size = src.GetSize();
+    hdr.item_count = col.entries.size();
+    hdr.created_count = created_idx.size();
+    hdr.label_count = label_count;
+    hdr.field_2c = 0;
+
+    boost::filesystem::create_directories(directory);
+    auto path = GetPath();
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        auto sink = Sink::ToFile(tmp_path, size);
+        sink->WriteGen(hdr);
+        for (auto& e : col.entries) sink->WriteGen(e);
+        for (auto i : created_idx) sink->WriteLittleUint32(i);
+        for (auto& l : ctx.labels)
+        {
+            sink->WriteLittleUint32(ToFilePos(l.ptr));
+            sink->WriteCString(l.name);
+        }
+    }
+    // write to a temporary file and rename, so other processes never see a
+    // partial cache file
+    boost::filesystem::rename(tmp_path, path);
+    DBG(1) << "Stored parse cache " << path << std::endl;
+}
+
+}
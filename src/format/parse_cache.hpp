@@ -0,0 +1,96 @@
+#ifndef UUID_FD06CC0F_CC28_4D16_86C9_59715A44FC96
+#define UUID_FD06CC0F_CC28_4D16_86C9_59715A44FC96
+#pragma once
+
+#include "item.hpp"
+#include "../source.hpp"
+
+#include <vector>
+#include <boost/endian/arithmetic.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace Neptools
+{
+
+// Binary snapshot of a parsed Context, stored in a cache directory and keyed
+// by the source's content hash. Restoring it skips the discovery part of the
+// parser (following labels, splitting RawItems, the parse queue): items are
+// constructed from their known positions in the same order as the original
+// parse did, so labels get the same names.
+//
+// usage in a parser:
+//   ParseCache cache{*this, src, "stcm"};
+//   if (cache.Restore(&CreateItem)) return;
+//   ...parse normally...
+//   cache.Store();
+class ParseCache final
+{
+public:
+    // construct an item of kind from src (starting at the item's position and
+    // extending to the end of file, like RawItem::GetSource(ptr, -1) during a
+    // normal parse). size is the item's size, including its children.
+    using CreateFun = NotNull<SmartPtr<Item>> (*)(
+        Context& ctx, ItemKind kind, const Source& src, FilePosition size);
+
+    struct Header
+    {
+        char magic[8];
+        boost::endian::little_uint32_t version;
+        char format[4];
+        boost::endian::little_uint64_t hash;
+        boost::endian::little_uint64_t source_size;
+        boost::endian::little_uint32_t item_count;
+        boost::endian::little_uint32_t created_count;
+        boost::endian::little_uint32_t label_count;
+        boost::endian::little_uint32_t field_2c;
+
+        void Validate(const char* format, uint64_t hash,
+                      FilePosition source_size, FilePosition file_size) const;
+    };
+    NEPTOOLS_STATIC_ASSERT(sizeof(Header) == 0x30);
+
+    // items in preorder, without the context itself
+    struct ItemEntry
+    {
+        boost::endian::little_uint8_t kind;
+        boost::endian::little_uint8_t depth;
+        boost::endian::little_uint16_t field_02;
+        boost::endian::little_uint32_t position;
+        boost::endian::little_uint32_t size;
+    };
+    NEPTOOLS_STATIC_ASSERT(sizeof(ItemEntry) == 0xc);
+
+    // format: 4 chars, used in the file name and header. variant: anything
+    // else that changes the parse result (e.g. the opcode table), it's mixed
+    // into the hash
+    ParseCache(Context& ctx, const Source& src, const char* format,
+               uint32_t variant = 0);
+    ~ParseCache();
+    ParseCache(const ParseCache&) = delete;
+    void operator=(const ParseCache&) = delete;
+
+    // returns true if ctx was restored from the cache. otherwise ctx is left
+    // empty and the items created until Store are recorded
+    bool Restore(CreateFun create);
+    void Store() noexcept;
+
+    // empty path disables caching (default)
+    static void SetDirectory(boost::filesystem::path dir);
+    static const boost::filesystem::path& GetDirectory() noexcept;
+
+private:
+    void Restore_(const Source& cache, CreateFun create);
+    void Store_();
+    boost::filesystem::path GetPath() const;
+
+    Context& ctx;
+    const Source& src;
+    const char* format;
+    uint32_t variant;
+    uint64_t hash;
+    bool recording = false;
+    std::vector<Item*> created;
+};
+
+}
+#endif
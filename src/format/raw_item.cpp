@@ -83,6 +83,7 @@ void RawItem::Split2(FilePosition pos, NotNull<SmartPtr<Item>> nitem)
         return;
     }
 
+    auto old_size = GetSize();
     SliceSeq seq;
     if (pos != 0) seq.push_back({MakeNotNull(this), pos});
     seq.push_back({std::move(nitem), pos+len});
@@ -100,6 +101,7 @@ void RawItem::Split2(FilePosition pos, NotNull<SmartPtr<Item>> nitem)
     }
     else
         src.Slice(0, pos);
+    SizeChanged(old_size, GetSize());
 }
 
 RawItem& RawItem::Split(FilePosition offset, FilePosition size)
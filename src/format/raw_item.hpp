@@ -12,6 +12,8 @@ namespace Neptools
 class RawItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::RAW;
+    using KindOwner = RawItem;
     RawItem(Key k, Context* ctx, Source src, FilePosition pos = 0) noexcept
         : Item{k, ctx, pos}, src{std::move(src)} {}
 
@@ -73,21 +75,28 @@ private:
     DumpableSource src;
 };
 
+// these only queue the parsing, see Context::QueueParse
 template <typename T>
 inline void MaybeCreate(ItemPointer ptr)
 {
-    auto item = ptr.Maybe<RawItem>();
-    if (item)
-        T::CreateAndInsert(ptr);
-    else
-        ptr.As0<T>(); // assert it
+    ptr->GetUnsafeContext().QueueParse(ptr, [](ItemPointer ptr)
+    {
+        auto item = ptr.Maybe<RawItem>();
+        if (item)
+            T::CreateAndInsert(ptr);
+        else
+            ptr.As0<T>(); // assert it
+    });
 }
 
 template <typename T>
 inline void MaybeCreateUnchecked(ItemPointer ptr)
 {
-    if (ptr.Maybe<RawItem>())
-        T::CreateAndInsert(ptr);
+    ptr->GetUnsafeContext().QueueParse(ptr, [](ItemPointer ptr)
+    {
+        if (ptr.Maybe<RawItem>())
+            T::CreateAndInsert(ptr);
+    });
 }
 
 
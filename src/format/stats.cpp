@@ -0,0 +1,140 @@
+#include "stats.hpp"
+#include "context.hpp"
+#include "gbnl.hpp"
+#include "stcm/collection_link.hpp"
+#include "stcm/exports.hpp"
+#include "stcm/gbnl.hpp"
+#include "stcm/instruction.hpp"
+#include "stsc/instruction.hpp"
+#include "stsc/string.hpp"
+#include <iostream>
+
+namespace Neptools
+{
+
+static size_t HeapSize(const std::string& str) noexcept
+{
+    // short strings are stored inside the object
+    static const size_t sso_capacity = std::string{}.capacity();
+    return str.capacity() > sso_capacity ? str.capacity() + 1 : 0;
+}
+
+static size_t HeapSize(const Gbnl::OffsetString& str) noexcept
+{
+    // views point into the Source
+    return str.IsView() ? 0 : HeapSize(str.GetOwned());
+}
+
+template <typename T>
+static size_t HeapSize(const std::vector<T>& vect) noexcept
+{ return vect.capacity() * sizeof(T); }
+
+template <typename T, size_t N>
+static size_t HeapSize(
+    const boost::container::small_vector<T, N>& vect) noexcept
+{ return vect.capacity() > N ? vect.capacity() * sizeof(T) : 0; }
+
+void ContextStats::Add(const Context& ctx)
+{
+    ForEachItem<Item>(static_cast<const Item&>(ctx), [&](const Item& it)
+    {
+        ++item_counts[static_cast<uint8_t>(it.GetKind())];
+        for (const auto& l : it.GetLabels())
+        {
+            ++labels;
+            label_bytes += sizeof(Label) + HeapSize(l.name);
+        }
+
+        switch (it.GetKind())
+        {
+        case ItemKind::RAW:
+            raw_bytes += it.GetSize();
+            break;
+
+        case ItemKind::STCM_EXPORTS:
+            vector_bytes += HeapSize(
+                AssertedCast<const Stcm::ExportsItem>(it).entries);
+            break;
+        case ItemKind::STCM_COLLECTION_LINK:
+            vector_bytes += HeapSize(
+                AssertedCast<const Stcm::CollectionLinkItem>(it).entries);
+            break;
+        case ItemKind::STCM_GBNL:
+            Add(AssertedCast<const Stcm::GbnlItem>(it));
+            break;
+        case ItemKind::STCM_INSTRUCTION:
+            vector_bytes += HeapSize(
+                AssertedCast<const Stcm::InstructionItem>(it).params);
+            break;
+
+        case ItemKind::STSC_INSTRUCTION:
+            vector_bytes +=
+                AssertedCast<const Stsc::InstructionBase>(it).GetHeapSize();
+            break;
+        case ItemKind::STSC_STRING:
+            string_bytes += HeapSize(
+                AssertedCast<const Stsc::StringItem>(it).str);
+            break;
+
+        default:
+            break;
+        }
+    });
+}
+
+void ContextStats::Add(const Gbnl& gbnl)
+{
+    const auto& table = gbnl.messages;
+    vector_bytes += (table.capacity() - table.size()) * table.GetStride();
+    messages += table.size();
+    message_bytes += table.size() * table.GetStride();
+    for (auto m : table)
+        for (size_t i = 0; i < m.GetSize(); ++i)
+            if (m.Is<Gbnl::OffsetString>(i))
+                string_bytes += HeapSize(m.Get<Gbnl::OffsetString>(i));
+}
+
+const char* GetKindName(ItemKind kind) noexcept
+{
+    switch (kind)
+    {
+    case ItemKind::RAW:                         return "raw";
+    case ItemKind::EOF_ITEM:                    return "eof";
+    case ItemKind::STCM_HEADER:                 return "stcm_header";
+    case ItemKind::STCM_EXPORTS:                return "stcm_exports";
+    case ItemKind::STCM_COLLECTION_LINK_HEADER: return "stcm_collection_link_header";
+    case ItemKind::STCM_COLLECTION_LINK:        return "stcm_collection_link";
+    case ItemKind::STCM_GBNL:                   return "stcm_gbnl";
+    case ItemKind::STSC_HEADER:                 return "stsc_header";
+    case ItemKind::STSC_INSTRUCTION:            return "stsc_instruction";
+    case ItemKind::STSC_STRING:                 return "stsc_string";
+    case ItemKind::CONTEXT:                     return "context";
+    case ItemKind::STCM_INSTRUCTION:            return "stcm_instruction";
+    case ItemKind::STCM_DATA:                   return "stcm_data";
+    }
+    return "unknown";
+}
+
+std::ostream& operator<<(std::ostream& os, const ContextStats& stats)
+{
+    size_t items = 0;
+    os << "items:\n";
+    for (size_t i = 0; i < stats.item_counts.size(); ++i)
+        if (stats.item_counts[i])
+        {
+            os << "  " << GetKindName(static_cast<ItemKind>(i)) << ": "
+               << stats.item_counts[i] << '\n';
+            items += stats.item_counts[i];
+        }
+    os << "  total: " << items << '\n'
+       << "labels: " << stats.labels << " (" << stats.label_bytes
+       << " bytes)\n"
+       << "raw data: " << stats.raw_bytes << " bytes (in source)\n"
+       << "strings: " << stats.string_bytes << " bytes\n"
+       << "gbnl messages: " << stats.messages << " (" << stats.message_bytes
+       << " bytes)\n"
+       << "vectors: " << stats.vector_bytes << " bytes\n";
+    return os;
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef UUID_E1954831_B620_4849_BE00_C34B2DBC5E20
+#define UUID_E1954831_B620_4849_BE00_C34B2DBC5E20
+#pragma once
+
+#include "item_base.hpp"
+#include <array>
+#include <iosfwd>
+
+namespace Neptools
+{
+
+class Gbnl;
+
+// Object and memory census of parsed files. Heap blocks are counted with
+// their requested size (string/vector capacity), allocator overhead is not
+// included.
+struct ContextStats
+{
+    std::array<size_t, 256> item_counts{};
+    size_t labels = 0, label_bytes = 0;
+    // referenced by RawItems, owned by the Source (not a copy)
+    size_t raw_bytes = 0;
+    size_t string_bytes = 0;
+    size_t messages = 0, message_bytes = 0;
+    size_t vector_bytes = 0;
+
+    void Add(const Context& ctx);
+    void Add(const Gbnl& gbnl);
+};
+
+std::ostream& operator<<(std::ostream& os, const ContextStats& stats);
+const char* GetKindName(ItemKind kind) noexcept;
+
+}
+#endif
@@ -14,6 +14,8 @@ namespace Stcm
 class CollectionLinkHeaderItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_COLLECTION_LINK_HEADER;
+    using KindOwner = CollectionLinkHeaderItem;
     struct Header
     {
         boost::endian::little_uint32_t field_00;
@@ -53,6 +55,8 @@ private:
 class CollectionLinkItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_COLLECTION_LINK;
+    using KindOwner = CollectionLinkItem;
     struct Entry
     {
         boost::endian::little_uint32_t name_0;
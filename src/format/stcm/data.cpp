@@ -42,7 +42,7 @@ DataItem& DataItem::CreateAndInsert(ItemPointer ptr)
     // hack
     if (!ret.GetChildren().empty())
     {
-        auto child = dynamic_cast<RawItem*>(&ret.GetChildren().front());
+        auto child = MaybeCast<RawItem>(&ret.GetChildren().front());
         if (child && child->GetSize() > sizeof(Gbnl::Header))
         {
             char buf[4];
@@ -13,6 +13,8 @@ namespace Stcm
 class DataItem final : public ItemWithChildren
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_DATA;
+    using KindOwner = DataItem;
     struct Header
     {
         boost::endian::little_uint32_t type;
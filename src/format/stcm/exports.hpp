@@ -16,6 +16,8 @@ class HeaderItem;
 class ExportsItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_EXPORTS;
+    using KindOwner = ExportsItem;
     enum Type : uint32_t
     {
         CODE = 0,
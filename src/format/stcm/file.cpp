@@ -1,8 +1,19 @@
 #include "file.hpp"
+#include "collection_link.hpp"
+#include "data.hpp"
+#include "exports.hpp"
 #include "header.hpp"
+#include "instruction.hpp"
 #include "../item.hpp"
 #include "../eof_item.hpp"
+#include "../parse_cache.hpp"
 #include "gbnl.hpp"
+#include "../../except.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+#define NEPTOOLS_LOG_NAME "stcm"
+#include "../../logger_helper.hpp"
 
 namespace Neptools
 {
@@ -11,71 +22,235 @@ namespace Stcm
 
 File::File(Source src)
 {
+    TrackKind(ItemKind::STCM_GBNL);
     AddInfo(&File::Parse_, ADD_SOURCE(src), this, src);
 }
 
+static NotNull<SmartPtr<Item>> CreateCachedItem(
+    Context& ctx, ItemKind kind, const Source& src, FilePosition size)
+{
+    switch (kind)
+    {
+    case ItemKind::STCM_HEADER:
+        src.CheckSize(sizeof(HeaderItem::Header));
+        return ctx.Create<HeaderItem>(src.PreadGen<HeaderItem::Header>(0));
+    case ItemKind::STCM_EXPORTS:
+        return ctx.Create<ExportsItem>(
+            Source{src, 0, size}, size / sizeof(ExportsItem::Entry));
+    case ItemKind::STCM_COLLECTION_LINK_HEADER:
+        src.CheckSize(sizeof(CollectionLinkHeaderItem::Header));
+        return ctx.Create<CollectionLinkHeaderItem>(
+            src.PreadGen<CollectionLinkHeaderItem::Header>(0));
+    case ItemKind::STCM_COLLECTION_LINK:
+        if (size == 0) return ctx.Create<CollectionLinkItem>();
+        return ctx.Create<CollectionLinkItem>(
+            Source{src, 0, size}, size / sizeof(CollectionLinkItem::Entry));
+    case ItemKind::STCM_GBNL:
+        return ctx.Create<GbnlItem>(Source{src, 0, size});
+    case ItemKind::STCM_INSTRUCTION:
+        return ctx.Create<InstructionItem>(src);
+    case ItemKind::STCM_DATA:
+        src.CheckSize(sizeof(DataItem::Header));
+        return ctx.Create<DataItem>(
+            src.PreadGen<DataItem::Header>(0), size - sizeof(DataItem::Header));
+    default:
+        NEPTOOLS_THROW(DecodeError{"Stcm: invalid cached item"});
+    }
+}
+
 void File::Parse_(Source& src)
 {
+    ParseCache cache{*this, src, "stcm"};
+    if (cache.Restore(&CreateCachedItem)) return;
+
     auto root = Create<RawItem>(src);
     SetupParseFrom(*root);
     root->Split(root->GetSize(), Create<EofItem>());
     HeaderItem::CreateAndInsert({root.get(), 0});
+    cache.Store();
 }
 
 std::vector<NotNull<SmartPtr<const GbnlItem>>> File::FindGbnl() const
 {
     std::vector<NotNull<SmartPtr<const GbnlItem>>> ret;
-    FindGbnl_<const Item, const GbnlItem>(*this, ret);
+    for (auto it : GetTrackedItems(ItemKind::STCM_GBNL))
+        ret.emplace_back(&AssertedCast<const GbnlItem>(*it));
     return ret;
 }
 
 std::vector<NotNull<SmartPtr<GbnlItem>>> File::FindGbnl()
 {
     std::vector<NotNull<SmartPtr<GbnlItem>>> ret;
-    FindGbnl_<Item, GbnlItem>(*this, ret);
+    for (auto it : GetTrackedItems(ItemKind::STCM_GBNL))
+        ret.emplace_back(&AssertedCast<GbnlItem>(*it));
     return ret;
 }
 
 namespace
 {
-// automatically determine if we need dynamic_cast to ptr* or const ptr*
-template <typename T, typename Ref> struct MkPtr;
-template <typename T, typename Ref>
-struct MkPtr<T*, Ref> { using type = T*; };
-template <typename T, typename Ref>
-struct MkPtr<T*, const Ref> { using type = const T*; };
 
-template <typename T, typename Ref>
-using MkPtrT = typename MkPtr<T, Ref>::type;
+// Follows the same references as the full parse (exports, call targets,
+// fallthrough, instruction pointer and MEM_OFFSET params), but only reads the
+// headers and builds no items.
+struct GbnlScanner
+{
+    const Source& src;
+    FilePosition size;
+    std::unordered_map<FilePosition, bool> seen; // offset -> is data
+    std::vector<std::pair<FilePosition, bool>> queue;
+    std::vector<std::pair<FilePosition, FilePosition>> gbnls; // begin, end
+
+    template <typename T>
+    T Read(FilePosition pos) const
+    {
+        if (pos > size || size - pos < sizeof(T))
+            NEPTOOLS_THROW(DecodeError{"Stcm scan: premature end of data"});
+        return src.PreadGen<T>(pos);
+    }
+
+    void Queue(FilePosition pos, bool data)
+    {
+        auto it = seen.emplace(pos, data);
+        if (it.second)
+            queue.emplace_back(pos, data);
+        else if (it.first->second != data)
+            NEPTOOLS_THROW(DecodeError{"Stcm scan: item kind mismatch"});
+    }
+
+    void Instruction(FilePosition pos);
+    void Data(FilePosition pos);
+    void Run(const HeaderItem::Header& hdr);
+};
+
+void GbnlScanner::Instruction(FilePosition pos)
+{
+    using IP = InstructionItem::Parameter;
+    auto hdr = Read<InstructionItem::Header>(pos);
+    hdr.Validate(size);
+    if (hdr.size > size - pos)
+        NEPTOOLS_THROW(DecodeError{"Stcm scan: premature end of data"});
+
+    if (hdr.is_call) Queue(hdr.opcode, false);
+    if (hdr.is_call || !InstructionItem::IsNoReturn(hdr.opcode))
+        Queue(pos + hdr.size, false);
+    for (uint32_t i = 0; i < hdr.param_count; ++i)
+    {
+        auto p = Read<IP>(pos + sizeof(hdr) + i*sizeof(IP));
+        p.Validate(size);
+        if (IP::TypeTag(p.param_0) == IP::Type0::MEM_OFFSET)
+            Queue(IP::Value(p.param_0), true);
+        else if (p.param_0 == IP::Type0Special::INSTR_PTR0 ||
+                 p.param_0 == IP::Type0Special::INSTR_PTR1)
+            Queue(p.param_4, false);
+    }
+}
+
+void GbnlScanner::Data(FilePosition pos)
+{
+    auto hdr = Read<DataItem::Header>(pos);
+    auto begin = pos + sizeof(hdr);
+    hdr.Validate(size - begin);
+
+    // DataItem::CreateAndInsert's check
+    if (hdr.length > sizeof(Gbnl::Header))
+    {
+        char magic[4];
+        src.Pread(begin + hdr.length - sizeof(Gbnl::Header), magic, 4);
+        if (memcmp(magic, "GBNL", 4) == 0)
+            gbnls.emplace_back(begin, begin + hdr.length);
+    }
+}
+
+void GbnlScanner::Run(const HeaderItem::Header& hdr)
+{
+    for (uint32_t i = 0; i < hdr.export_count; ++i)
+    {
+        auto e = Read<ExportsItem::Entry>(
+            hdr.export_offset + i*sizeof(ExportsItem::Entry));
+        e.Validate(size);
+        Queue(e.offset, e.type == ExportsItem::Type::DATA);
+    }
+
+    while (!queue.empty())
+    {
+        auto x = queue.back();
+        queue.pop_back();
+        if (x.second) Data(x.first);
+        else Instruction(x.first);
+    }
+
+    // something pointing into a GBNL would split it in the full parse
+    std::sort(gbnls.begin(), gbnls.end());
+    for (const auto& s : seen)
+    {
+        auto it = std::upper_bound(
+            gbnls.begin(), gbnls.end(),
+            std::make_pair(s.first, FilePosition(-1)));
+        if (it != gbnls.begin() && s.first < (it-1)->second)
+            NEPTOOLS_THROW(DecodeError{"Stcm scan: reference into GBNL"});
+    }
 }
 
-template <typename ItemT, typename GbnlT>
-void File::FindGbnl_(
-    ItemT& root, std::vector<NotNull<SmartPtr<GbnlT>>>& vect) const
+}
+
+std::vector<NotNull<SmartPtr<Gbnl>>> File::ScanGbnl(const Source& src)
 {
-    auto x = dynamic_cast<MkPtrT<Stcm::GbnlItem*, ItemT>>(&root);
-    if (x)
+    auto size = src.GetSize();
+    src.CheckSize(sizeof(HeaderItem::Header));
+    auto hdr = src.PreadGen<HeaderItem::Header>(0);
+    hdr.Validate(size);
+
+    GbnlScanner scan{src, size, {}, {}, {}};
+    std::vector<NotNull<SmartPtr<Gbnl>>> ret;
+    try
     {
-        vect.emplace_back(x);
-        return;
+        scan.Run(hdr);
+        ret.reserve(scan.gbnls.size());
+        for (const auto& g : scan.gbnls)
+            ret.push_back(MakeSmart<Gbnl>(
+                Source{src, g.first, g.second - g.first}));
     }
+    catch (const DecodeError& e)
+    {
+        DBG(1) << "GBNL scan failed: " << e.what() << std::endl;
+        return {};
+    }
+    return ret;
+}
 
-    auto ch = dynamic_cast<MkPtrT<ItemWithChildren*, ItemT>>(&root);
-    if (ch)
-        for (auto& c : ch->GetChildren())
-            FindGbnl_<ItemT, GbnlT>(c, vect);
+void File::WriteTxt_(TxtWriter& wr) const
+{
+    for (auto& x : FindGbnl())
+        x->WriteTxt(wr);
 }
 
-void File::WriteTxt_(std::ostream& os) const
+void File::ReadTxt_(TxtReader& rd)
 {
     for (auto& x : FindGbnl())
-        x->WriteTxt(os);
+    {
+        x->PrepareModify();
+        x->ReadTxt(rd);
+        x->InvalidateSize();
+    }
 }
 
-void File::ReadTxt_(std::istream& is)
+void File::ForEachString_(const StringFun& fun) const
 {
     for (auto& x : FindGbnl())
-        x->ReadTxt(is);
+        x->ForEachString(fun);
+}
+
+size_t File::ReplaceStrings_(const ReplaceFun& fun)
+{
+    size_t count = 0;
+    for (auto& x : FindGbnl())
+    {
+        x->PrepareModify();
+        auto n = x->ReplaceStrings(fun);
+        if (n) x->InvalidateSize();
+        count += n;
+    }
+    return count;
 }
 
 
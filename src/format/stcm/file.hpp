@@ -16,18 +16,25 @@ class File : public Context, public TxtSerializable
 {
 public:
     File(Source src);
+    // GbnlItems in file order, from the context's registry (no tree walk)
     std::vector<NotNull<SmartPtr<const GbnlItem>>> FindGbnl() const;
     std::vector<NotNull<SmartPtr<GbnlItem>>> FindGbnl();
 
+    // Text-only scan: locate the GBNL chunks in an STCM file by following the
+    // references from the exports like the full parser, but only reading the
+    // headers and without building the item graph. The chunks are returned in
+    // file order, like FindGbnl would. Returns an empty vector if the file has
+    // no GBNL or has anything the scan can't handle, use the full parser in
+    // that case. The result can't be written back.
+    static std::vector<NotNull<SmartPtr<Gbnl>>> ScanGbnl(const Source& src);
+
 private:
     void Parse_(Source& src);
 
-    template <typename ItemT, typename GbnlT>
-    void FindGbnl_(
-        ItemT& root, std::vector<NotNull<SmartPtr<GbnlT>>>& vect) const;
-
-    void WriteTxt_(std::ostream& os) const override;
-    void ReadTxt_(std::istream& is) override;
+    void WriteTxt_(TxtWriter& wr) const override;
+    void ReadTxt_(TxtReader& rd) override;
+    void ForEachString_(const StringFun& fun) const override;
+    size_t ReplaceStrings_(const ReplaceFun& fun) override;
 };
 
 }
@@ -18,5 +18,14 @@ GbnlItem& GbnlItem::CreateAndInsert(ItemPointer ptr)
     return x.ritem.SplitCreate<GbnlItem>(ptr.offset, x.src);
 }
 
+std::function<void ()> GbnlItem::SaveState()
+{
+    return [this, messages = messages]()
+    {
+        this->messages = messages;
+        RecalcSize();
+    };
+}
+
 }
 }
@@ -15,6 +15,8 @@ namespace Stcm
 class GbnlItem final : public Item, public Gbnl
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_GBNL;
+    using KindOwner = GbnlItem;
     GbnlItem(Key k, Context* ctx, Source src);
     static GbnlItem& CreateAndInsert(ItemPointer ptr);
 
@@ -24,6 +26,7 @@ public:
 private:
     void Dump_(Sink& sink) const override { Gbnl::Dump_(sink); }
     void Inspect_(std::ostream& os) const override { Gbnl::Inspect_(os); }
+    std::function<void ()> SaveState() override;
 };
 
 }
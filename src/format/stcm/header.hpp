@@ -14,6 +14,8 @@ namespace Stcm
 class HeaderItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_HEADER;
+    using KindOwner = HeaderItem;
     struct Header
     {
         struct MsgParts
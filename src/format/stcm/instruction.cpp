@@ -4,7 +4,6 @@
 #include "../raw_item.hpp"
 #include "../../except.hpp"
 #include "../../sink.hpp"
-#include <set>
 #include <iostream>
 
 namespace Neptools
@@ -130,14 +129,14 @@ void InstructionItem::ConvertParam(Param& out, const Parameter& in)
         out.type = Param::MEM_OFFSET;
         out.param_0.label = &GetUnsafeContext().GetLabelTo(
             Parameter::Value(in.param_0));
-        ConvertParam48(out.param_4, in.param_4);
-        ConvertParam48(out.param_8, in.param_8);
+        out.SetParam4(ConvertParam48(in.param_4));
+        out.SetParam8(ConvertParam48(in.param_8));
         break;
 
     case Parameter::Type0::INDIRECT:
         out.type = Param::INDIRECT;
         out.param_0.num = Parameter::Value(in.param_0);
-        ConvertParam48(out.param_8, in.param_8);
+        out.SetParam8(ConvertParam48(in.param_8));
         break;
 
     case Parameter::Type0::SPECIAL:
@@ -177,34 +176,35 @@ void InstructionItem::ConvertParam(Param& out, const Parameter& in)
     }
 }
 
-void InstructionItem::ConvertParam48(Param48& out, uint32_t in)
+auto InstructionItem::ConvertParam48(uint32_t in) -> Param48
 {
+    Param48 out;
     switch (Parameter::TypeTag(in))
     {
     case Parameter::Type48::MEM_OFFSET:
         out.type = Param48::MEM_OFFSET;
-        out.label = &GetUnsafeContext().GetLabelTo(Parameter::Value(in));
+        out.value.label = &GetUnsafeContext().GetLabelTo(Parameter::Value(in));
         break;
     case Parameter::Type48::IMMEDIATE:
         out.type = Param48::IMMEDIATE;
-        out.num = Parameter::Value(in);
+        out.value.num = Parameter::Value(in);
         break;
     case Parameter::Type48::INDIRECT:
         out.type = Param48::INDIRECT;
-        out.num = Parameter::Value(in);
+        out.value.num = Parameter::Value(in);
         break;
     case Parameter::Type48::SPECIAL:
         if (in >= Parameter::Type48Special::READ_STACK_MIN &&
             in <= Parameter::Type48Special::READ_STACK_MAX)
         {
             out.type = Param48::READ_STACK;
-            out.num = in - Parameter::Type48Special::READ_STACK_MIN;
+            out.value.num = in - Parameter::Type48Special::READ_STACK_MIN;
         }
         else if (in >= Parameter::Type48Special::READ_4AC_MIN &&
                  in <= Parameter::Type48Special::READ_4AC_MAX)
         {
             out.type = Param48::READ_4AC;
-            out.num = in - Parameter::Type48Special::READ_4AC_MIN;
+            out.value.num = in - Parameter::Type48Special::READ_4AC_MIN;
         }
         else
             NEPTOOLS_UNREACHABLE("Invalid 48Special param");
@@ -213,10 +213,9 @@ void InstructionItem::ConvertParam48(Param48& out, uint32_t in)
     default:
         NEPTOOLS_UNREACHABLE("Invalid 48 param");
     }
+    return out;
 }
 
-static const std::set<uint32_t> no_returns{0, 6};
-
 InstructionItem& InstructionItem::CreateAndInsert(ItemPointer ptr)
 {
     auto x = RawItem::GetSource(ptr, -1);
@@ -234,10 +233,10 @@ InstructionItem& InstructionItem::CreateAndInsert(ItemPointer ptr)
 
     NEPTOOLS_ASSERT(ret.GetSize() == inst.size);
 
-    // recursive parse
+    // queue the targets and the next instruction, parsed after this returns
     if (ret.is_call)
         MaybeCreate<InstructionItem>(ret.target->ptr);
-    if (ret.is_call || !no_returns.count(ret.opcode))
+    if (ret.is_call || !IsNoReturn(ret.opcode))
         MaybeCreate<InstructionItem>({&*++ret.Iterator(), 0});
     for (const auto& p : ret.params)
     {
@@ -259,24 +258,25 @@ FilePosition InstructionItem::GetSize() const noexcept
 }
 
 void InstructionItem::Dump48(
-    boost::endian::little_uint32_t& out, const Param48& in) const noexcept
+    boost::endian::little_uint32_t& out, Param48 in) const noexcept
 {
     switch (in.type)
     {
     case Param48::MEM_OFFSET:
-        out = Parameter::Tag(Parameter::Type48::MEM_OFFSET, ToFilePos(in.label->ptr));
+        out = Parameter::Tag(
+            Parameter::Type48::MEM_OFFSET, ToFilePos(in.value.label->ptr));
         return;
     case Param48::IMMEDIATE:
-        out = Parameter::Tag(Parameter::Type48::IMMEDIATE, in.num);
+        out = Parameter::Tag(Parameter::Type48::IMMEDIATE, in.value.num);
         return;
     case Param48::INDIRECT:
-        out = Parameter::Tag(Parameter::Type48::INDIRECT, in.num);
+        out = Parameter::Tag(Parameter::Type48::INDIRECT, in.value.num);
         return;
     case Param48::READ_STACK:
-        out = Parameter::Type48Special::READ_STACK_MIN + in.num;
+        out = Parameter::Type48Special::READ_STACK_MIN + in.value.num;
         return;
     case Param48::READ_4AC:
-        out = Parameter::Type48Special::READ_4AC_MIN + in.num;
+        out = Parameter::Type48Special::READ_4AC_MIN + in.value.num;
         return;
     }
     NEPTOOLS_UNREACHABLE("Invalid Param48 Type stored");
@@ -314,14 +314,14 @@ void InstructionItem::Dump_(Sink& sink) const
         case Param::MEM_OFFSET:
             pp.param_0 =
                 Parameter::Tag(Parameter::Type0::MEM_OFFSET, ToFilePos(p.param_0.label->ptr));
-            Dump48(pp.param_4, p.param_4);
-            Dump48(pp.param_8, p.param_8);
+            Dump48(pp.param_4, p.GetParam4());
+            Dump48(pp.param_8, p.GetParam8());
             break;
 
         case Param::INDIRECT:
             pp.param_0 = Parameter::Tag(Parameter::Type0::INDIRECT, p.param_0.num);
             pp.param_4 = 0x40000000;
-            Dump48(pp.param_8, p.param_8);
+            Dump48(pp.param_8, p.GetParam8());
             break;
 
         case Param::READ_STACK:
@@ -386,15 +386,15 @@ std::ostream& operator<<(std::ostream& os, const InstructionItem::Param48& p)
     switch (p.type)
     {
     case InstructionItem::Param48::MEM_OFFSET:
-        return os << "@" << p.label->name;
+        return os << "@" << p.value.label->name;
     case InstructionItem::Param48::IMMEDIATE:
-        return os << p.num;
+        return os << p.value.num;
     case InstructionItem::Param48::INDIRECT:
-        return os << "indirect(" << p.num << ')';
+        return os << "indirect(" << p.value.num << ')';
     case InstructionItem::Param48::READ_STACK:
-        return os << "stack(" << p.num << ')';
+        return os << "stack(" << p.value.num << ')';
     case InstructionItem::Param48::READ_4AC:
-        return os << "4ac(" << p.num << ')';
+        return os << "4ac(" << p.value.num << ')';
     }
     abort();
 }
@@ -404,9 +404,10 @@ std::ostream& operator<<(std::ostream& os, const InstructionItem::Param& p)
     {
     case InstructionItem::Param::MEM_OFFSET:
         return os << "mem_offset(@" << p.param_0.label->name << ", "
-                  << p.param_4 << ", " << p.param_8 << ')';
+                  << p.GetParam4() << ", " << p.GetParam8() << ')';
     case InstructionItem::Param::INDIRECT:
-        return os << "indirect(" << p.param_0.num << ", " << p.param_8 << ')';
+        return os << "indirect(" << p.param_0.num << ", " << p.GetParam8()
+                  << ')';
     case InstructionItem::Param::READ_STACK:
         return os << "stack(" << p.param_0.num << ")";
     case InstructionItem::Param::READ_4AC:
@@ -4,6 +4,7 @@
 
 #include "../item.hpp"
 #include "../../source.hpp"
+#include <boost/container/small_vector.hpp>
 #include <boost/endian/arithmetic.hpp>
 
 namespace Neptools
@@ -16,6 +17,8 @@ namespace Stcm
 class InstructionItem final : public ItemWithChildren
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STCM_INSTRUCTION;
+    using KindOwner = InstructionItem;
     struct Header
     {
         boost::endian::little_uint32_t is_call;
@@ -86,6 +89,9 @@ public:
     InstructionItem(Key k, Context* ctx) : ItemWithChildren{k, ctx} {}
     InstructionItem(Key k, Context* ctx, Source src);
     static InstructionItem& CreateAndInsert(ItemPointer ptr);
+    // no fallthrough to the next instruction after these opcodes
+    static bool IsNoReturn(uint32_t opcode) noexcept
+    { return opcode == 0 || opcode == 6; }
 
     FilePosition GetSize() const noexcept override;
     void Fixup() override;
@@ -97,9 +103,14 @@ public:
         const Label* target;
     };
 
+    union Value
+    {
+        const Label* label;
+        uint32_t num;
+    };
     struct Param48
     {
-        enum Type
+        enum Type : uint8_t
         {
             MEM_OFFSET,
             IMMEDIATE,
@@ -107,15 +118,13 @@ public:
             READ_STACK,
             READ_4AC,
         } type;
-        union
-        {
-            const Label* label;
-            uint32_t num;
-        };
+        Value value;
     };
+    // these are stored inline in every instruction: the type tags are grouped
+    // in front of the values, so only one of them is padded to pointer size
     struct Param
     {
-        enum Type
+        enum Type : uint8_t
         {
             MEM_OFFSET,
             INDIRECT,
@@ -125,14 +134,23 @@ public:
             INSTR_PTR1,
             COLL_LINK,
         } type;
-        union
-        {
-            const Label* label;
-            uint32_t num;
-        } param_0;
-        Param48 param_4, param_8;
+        Param48::Type type_4, type_8;
+        Value param_0, param_4, param_8;
+
+        Param48 GetParam4() const noexcept { return {type_4, param_4}; }
+        Param48 GetParam8() const noexcept { return {type_8, param_8}; }
+        void SetParam4(Param48 p) noexcept
+        { type_4 = p.type; param_4 = p.value; }
+        void SetParam8(Param48 p) noexcept
+        { type_8 = p.type; param_8 = p.value; }
     };
-    std::vector<Param> params;
+    NEPTOOLS_STATIC_ASSERT(sizeof(Param) == 4*sizeof(void*));
+
+    // Header::Validate allows at most 15, but most instructions have only a
+    // few params, so don't allocate for them. 4 Params are 128 bytes on
+    // x86-64, 2 would save 64 bytes per instruction but allocate for 3-4
+    static constexpr size_t INLINE_PARAMS = 4;
+    boost::container::small_vector<Param, INLINE_PARAMS> params;
 
     void Dispose() noexcept override;
 
@@ -141,9 +159,9 @@ private:
     void Inspect_(std::ostream& os) const override;
     void Parse_(Source& src);
 
-    void Dump48(boost::endian::little_uint32_t& out, const Param48& in) const noexcept;
+    void Dump48(boost::endian::little_uint32_t& out, Param48 in) const noexcept;
     void ConvertParam(Param& out, const Parameter& in);
-    void ConvertParam48(Param48& out, uint32_t in);
+    Param48 ConvertParam48(uint32_t in);
 };
 
 std::ostream& operator<<(std::ostream& os, const InstructionItem::Param48& p);
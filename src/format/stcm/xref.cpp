@@ -0,0 +1,209 @@
+#include "xref.hpp"
+#include "exports.hpp"
+#include "file.hpp"
+#include "instruction.hpp"
+#include "../../assert.hpp"
+#include "../../utils.hpp"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+namespace Neptools
+{
+namespace Stcm
+{
+
+template <typename Fun>
+void XrefIndex::ForEachRef(Fun f) const
+{
+    ForEachItem<Item>(static_cast<const Item&>(file), [&](const Item& it)
+    {
+        if (auto instr = MaybeCast<const InstructionItem>(&it))
+        {
+            if (instr->is_call)
+                f(*instr->target, Ref{instr, 0, RefType::CALL});
+
+            using Param = InstructionItem::Param;
+            using Param48 = InstructionItem::Param48;
+            uint32_t i = 0;
+            auto param = [&](const Label* lbl)
+            { f(*lbl, Ref{instr, i, RefType::PARAM}); };
+            auto param48 = [&](const Param48& p)
+            { if (p.type == Param48::MEM_OFFSET) param(p.value.label); };
+
+            for (const auto& p : instr->params)
+            {
+                switch (p.type)
+                {
+                case Param::MEM_OFFSET:
+                    param(p.param_0.label);
+                    param48(p.GetParam4());
+                    param48(p.GetParam8());
+                    break;
+                case Param::INDIRECT:
+                    param48(p.GetParam8());
+                    break;
+                case Param::INSTR_PTR0:
+                case Param::INSTR_PTR1:
+                case Param::COLL_LINK:
+                    param(p.param_4.label);
+                    break;
+                case Param::READ_STACK:
+                case Param::READ_4AC:
+                    break;
+                }
+                ++i;
+            }
+        }
+        else if (auto exp = MaybeCast<const ExportsItem>(&it))
+            for (uint32_t i = 0; i < exp->entries.size(); ++i)
+                f(*exp->entries[i].lbl, Ref{exp, i, RefType::EXPORT});
+    });
+}
+
+XrefIndex::XrefIndex(const File& file) : file{file}
+{
+    ForEachItem<Item>(static_cast<const Item&>(file), [&](const Item& it)
+    {
+        for (const auto& l : it.GetLabels())
+        {
+            label_indices.emplace(&l, labels.size());
+            labels.push_back(&l);
+        }
+    });
+
+    auto index = [&](const Label& lbl)
+    {
+        auto it = label_indices.find(&lbl);
+        NEPTOOLS_ASSERT(it != label_indices.end());
+        return it->second;
+    };
+
+    // count refs, then fill the slices
+    offsets.assign(labels.size() + 1, 0);
+    ForEachRef([&](const Label& lbl, const Ref&) { ++offsets[index(lbl)+1]; });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    refs.resize(offsets.back());
+    std::vector<uint32_t> next{offsets.begin(), offsets.end() - 1};
+    ForEachRef([&](const Label& lbl, const Ref& ref)
+    { refs[next[index(lbl)]++] = ref; });
+}
+
+XrefIndex::RefRange XrefIndex::GetRefs(const Label& lbl) const
+{
+    auto it = label_indices.find(&lbl);
+    if (it == label_indices.end()) return {nullptr, nullptr};
+    return {refs.data() + offsets[it->second],
+            refs.data() + offsets[it->second + 1]};
+}
+
+XrefIndex::CallGraph XrefIndex::GetCallGraph() const
+{
+    CallGraph ret;
+    std::vector<uint32_t> node_of(labels.size(), -1);
+    std::vector<FilePosition> node_pos;
+    for (uint32_t i = 0; i < labels.size(); ++i)
+        for (uint32_t j = offsets[i]; j < offsets[i+1]; ++j)
+        {
+            const auto& r = refs[j];
+            if (r.type == RefType::CALL ||
+                (r.type == RefType::EXPORT &&
+                 static_cast<const ExportsItem*>(r.item)->entries[r.index].type
+                     == ExportsItem::Type::CODE))
+            {
+                node_of[i] = ret.nodes.size();
+                ret.nodes.push_back(labels[i]);
+                // labels are in file order, so node_pos is sorted
+                node_pos.push_back(ToFilePos(labels[i]->ptr));
+                break;
+            }
+        }
+
+    for (uint32_t i = 0; i < labels.size(); ++i)
+        for (uint32_t j = offsets[i]; j < offsets[i+1]; ++j)
+        {
+            if (refs[j].type != RefType::CALL) continue;
+            auto it = std::upper_bound(
+                node_pos.begin(), node_pos.end(), refs[j].item->GetPosition());
+            if (it == node_pos.begin()) continue; // not inside any routine
+            ret.edges.emplace_back(it - node_pos.begin() - 1, node_of[i]);
+        }
+
+    std::sort(ret.edges.begin(), ret.edges.end());
+    ret.edges.erase(std::unique(ret.edges.begin(), ret.edges.end()),
+                    ret.edges.end());
+    return ret;
+}
+
+std::ostream& operator<<(std::ostream& os, XrefIndex::RefType type)
+{
+    switch (type)
+    {
+    case XrefIndex::RefType::CALL:   return os << "call";
+    case XrefIndex::RefType::PARAM:  return os << "param";
+    case XrefIndex::RefType::EXPORT: return os << "export";
+    }
+    NEPTOOLS_UNREACHABLE("Invalid RefType");
+}
+
+void XrefIndex::WriteRefs(std::ostream& os, const Label& lbl) const
+{
+    auto rng = GetRefs(lbl);
+    os << lbl.name << " @" << ToFilePos(lbl.ptr) << ": " << rng.size()
+       << " references\n";
+    for (const auto& r : rng)
+    {
+        os << "  " << r.type;
+        if (r.type != RefType::CALL) os << ' ' << r.index;
+        os << " @" << r.item->GetPosition() << '\n';
+    }
+}
+
+// export names come from the file. Context::FilterLabelName currently leaves
+// only alphanumeric characters in them, but don't depend on that here
+void XrefIndex::WriteDot(std::ostream& os, const CallGraph& graph)
+{
+    os << "digraph stcm {\n";
+    for (auto n : graph.nodes)
+    {
+        os << "    ";
+        DumpBytes(os, n->name);
+        os << ";\n";
+    }
+    for (const auto& e : graph.edges)
+    {
+        os << "    ";
+        DumpBytes(os, graph.nodes[e.first]->name);
+        os << " -> ";
+        DumpBytes(os, graph.nodes[e.second]->name);
+        os << ";\n";
+    }
+    os << "}\n";
+}
+
+void XrefIndex::WriteJson(std::ostream& os, const CallGraph& graph)
+{
+    os << "{\"nodes\":[";
+    bool first = true;
+    for (auto n : graph.nodes)
+    {
+        if (!first) os << ',';
+        first = false;
+        os << "{\"name\":";
+        DumpJsonString(os, n->name);
+        os << ",\"position\":" << ToFilePos(n->ptr) << '}';
+    }
+    os << "],\"edges\":[";
+    first = true;
+    for (const auto& e : graph.edges)
+    {
+        if (!first) os << ',';
+        first = false;
+        os << '[' << e.first << ',' << e.second << ']';
+    }
+    os << "]}\n";
+}
+
+}
+}
@@ -0,0 +1,78 @@
+#ifndef UUID_216A5C73_2037_46C5_8C91_5A8BCFFA9262
+#define UUID_216A5C73_2037_46C5_8C91_5A8BCFFA9262
+#pragma once
+
+#include "../item_base.hpp"
+#include <iosfwd>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/range/iterator_range.hpp>
+
+namespace Neptools
+{
+namespace Stcm
+{
+
+class File;
+
+// Reverse references of a parsed STCM: for every label, the calls,
+// instruction parameters and exports pointing to it. Built after parsing in
+// two passes over the items, stored as one array of references sliced by
+// per-label offsets. It's a snapshot: any change to the items (including
+// Fixup moving them around) invalidates it.
+class XrefIndex
+{
+public:
+    enum class RefType : uint8_t
+    {
+        CALL,   // index: unused
+        PARAM,  // index: parameter number
+        EXPORT, // index: export entry number
+    };
+
+    struct Ref
+    {
+        const Item* item; // InstructionItem or ExportsItem
+        uint32_t index;
+        RefType type;
+    };
+    using RefRange = boost::iterator_range<const Ref*>;
+
+    explicit XrefIndex(const File& file);
+
+    // labels in file order
+    const std::vector<const Label*>& GetLabels() const noexcept
+    { return labels; }
+    RefRange GetRefs(const Label& lbl) const;
+
+    // Routines are the targets of calls and code exports. An instruction
+    // belongs to the closest routine before it, edges are (caller, callee)
+    // indices into nodes, without duplicates.
+    struct CallGraph
+    {
+        std::vector<const Label*> nodes;
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+    };
+    CallGraph GetCallGraph() const;
+
+    void WriteRefs(std::ostream& os, const Label& lbl) const;
+    static void WriteDot(std::ostream& os, const CallGraph& graph);
+    static void WriteJson(std::ostream& os, const CallGraph& graph);
+
+private:
+    template <typename Fun> void ForEachRef(Fun f) const;
+
+    const File& file;
+    std::vector<const Label*> labels;
+    std::unordered_map<const Label*, uint32_t> label_indices;
+    // refs of labels[i]: refs[offsets[i]] .. refs[offsets[i+1]]
+    std::vector<uint32_t> offsets;
+    std::vector<Ref> refs;
+};
+
+std::ostream& operator<<(std::ostream& os, XrefIndex::RefType type);
+
+}
+}
+#endif
@@ -0,0 +1,148 @@
+#include "cfg.hpp"
+#include "file.hpp"
+#include "header.hpp"
+#include "instruction.hpp"
+#include "../raw_item.hpp"
+#include "../../utils.hpp"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace Neptools
+{
+namespace Stsc
+{
+
+Cfg::Cfg(const File& file) : file{file}
+{
+    // instructions in file order. falls[i]: instrs[i] continues with
+    // instrs[i+1], leaders[i]: instrs[i] starts a block
+    boost::dynamic_bitset<> falls, leaders;
+    std::unordered_map<const Item*, uint32_t> indices;
+    const Label* entry = nullptr;
+    bool prev_falls = false;
+    for (const auto& it : file.GetChildren())
+    {
+        auto instr = MaybeCast<const InstructionBase>(&it);
+        if (!instr)
+        {
+            if (auto hdr = MaybeCast<const HeaderItem>(&it))
+                entry = hdr->entry_point;
+            prev_falls = false;
+            continue;
+        }
+
+        if (prev_falls) falls.set(instrs.size() - 1);
+        indices.emplace(instr, instrs.size());
+        instrs.push_back(instr);
+        falls.push_back(false);
+        leaders.push_back(!prev_falls);
+        prev_falls = !instr->IsNoReturn();
+    }
+
+    // labels pointing into data or unparsed code are not part of the graph
+    auto index = [&](const Label* lbl) -> uint32_t
+    {
+        if (lbl->ptr.offset != 0) return -1;
+        auto it = indices.find(lbl->ptr.item);
+        return it == indices.end() ? -1 : it->second;
+    };
+
+    // targets and instructions after a branch start a new block
+    std::vector<uint32_t> tgt_offsets{0}, tgts;
+    std::vector<const Label*> lbls;
+    for (uint32_t i = 0; i < instrs.size(); ++i)
+    {
+        lbls.clear();
+        instrs[i]->GetTargets(lbls);
+        for (auto l : lbls)
+        {
+            auto t = index(l);
+            if (t == uint32_t(-1)) continue;
+            tgts.push_back(t);
+            leaders.set(t);
+        }
+        if (!lbls.empty() && i+1 < instrs.size()) leaders.set(i+1);
+        tgt_offsets.push_back(tgts.size());
+    }
+
+    std::vector<uint32_t> block_of(instrs.size());
+    for (uint32_t i = 0; i < instrs.size(); ++i)
+    {
+        if (leaders[i]) blocks.push_back({i, i});
+        blocks.back().end = i+1;
+        block_of[i] = blocks.size() - 1;
+    }
+
+    // only the last instruction of a block can branch
+    succ_offsets.reserve(blocks.size() + 1);
+    succ_offsets.push_back(0);
+    for (const auto& b : blocks)
+    {
+        auto last = b.end - 1;
+        auto first = succs.size();
+        for (auto j = tgt_offsets[last]; j < tgt_offsets[last+1]; ++j)
+            succs.push_back(block_of[tgts[j]]);
+        if (falls[last]) succs.push_back(block_of[last+1]);
+
+        std::sort(succs.begin() + first, succs.end());
+        succs.erase(std::unique(succs.begin() + first, succs.end()),
+                    succs.end());
+        succ_offsets.push_back(succs.size());
+    }
+
+    reachable.resize(blocks.size());
+    std::vector<uint32_t> stack;
+    if (entry && index(entry) != uint32_t(-1))
+        stack.push_back(block_of[index(entry)]);
+    while (!stack.empty())
+    {
+        auto b = stack.back();
+        stack.pop_back();
+        if (reachable[b]) continue;
+        reachable.set(b);
+        for (auto s : GetSuccessors(b))
+            if (!reachable[s]) stack.push_back(s);
+    }
+}
+
+void Cfg::WriteDeadCode(std::ostream& os) const
+{
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+        if (!reachable[i])
+            os << "unreachable @" << instrs[blocks[i].begin]->GetPosition()
+               << ": " << blocks[i].end - blocks[i].begin
+               << " instructions\n";
+
+    for (const auto& it : file.GetChildren())
+        if (auto raw = MaybeCast<const RawItem>(&it))
+            os << "unparsed @" << raw->GetPosition() << ": "
+               << raw->GetSize() << " bytes\n";
+}
+
+void Cfg::WriteDot(std::ostream& os) const
+{
+    os << "digraph stsc {\n";
+    std::stringstream label;
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+    {
+        auto instr = instrs[blocks[i].begin];
+        label.str("");
+        if (!instr->GetLabels().empty())
+            label << instr->GetLabels().begin()->name << '\n';
+        label << '@' << instr->GetPosition() << " ("
+              << blocks[i].end - blocks[i].begin << ')';
+        os << "    b" << i << " [label=";
+        DumpBytes(os, label.str());
+        if (!reachable[i]) os << ",style=dashed";
+        os << "];\n";
+    }
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+        for (auto s : GetSuccessors(i))
+            os << "    b" << i << " -> b" << s << ";\n";
+    os << "}\n";
+}
+
+}
+}
@@ -0,0 +1,65 @@
+#ifndef UUID_DD28A9D2_3DE1_44DD_B605_BBB5C34538D7
+#define UUID_DD28A9D2_3DE1_44DD_B605_BBB5C34538D7
+#pragma once
+
+#include "../item_base.hpp"
+#include <iosfwd>
+#include <vector>
+#include <boost/dynamic_bitset.hpp>
+#include <boost/range/iterator_range.hpp>
+
+namespace Neptools
+{
+namespace Stsc
+{
+
+class File;
+class InstructionBase;
+
+// Control-flow graph of a parsed STSC: the instructions split into basic
+// blocks, with successor edges from jump/call targets and fall-through, and
+// the blocks reachable from the header's entry point. Like Stcm::XrefIndex,
+// it's a snapshot of the items it was built from.
+class Cfg
+{
+public:
+    explicit Cfg(const File& file);
+
+    // instructions[begin] .. instructions[end]
+    struct Block
+    {
+        uint32_t begin, end;
+    };
+    using SuccessorRange = boost::iterator_range<const uint32_t*>;
+
+    // instructions in file order
+    const std::vector<const InstructionBase*>& GetInstructions() const noexcept
+    { return instrs; }
+    const std::vector<Block>& GetBlocks() const noexcept { return blocks; }
+    // block indices, without duplicates
+    SuccessorRange GetSuccessors(uint32_t block) const noexcept
+    {
+        return {succs.data() + succ_offsets[block],
+                succs.data() + succ_offsets[block+1]};
+    }
+    // one bit per block
+    const boost::dynamic_bitset<>& GetReachable() const noexcept
+    { return reachable; }
+
+    // unreachable blocks and unparsed (raw) regions of the file
+    void WriteDeadCode(std::ostream& os) const;
+    void WriteDot(std::ostream& os) const;
+
+private:
+    const File& file;
+    std::vector<const InstructionBase*> instrs;
+    std::vector<Block> blocks;
+    // successors of blocks[i]: succs[succ_offsets[i]] .. succs[succ_offsets[i+1]]
+    std::vector<uint32_t> succ_offsets;
+    std::vector<uint32_t> succs;
+    boost::dynamic_bitset<> reachable;
+};
+
+}
+}
+#endif
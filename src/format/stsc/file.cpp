@@ -1,27 +1,54 @@
 #include "file.hpp"
 #include "header.hpp"
+#include "instruction.hpp"
 #include "string.hpp"
-#include "../raw_item.hpp"
 #include "../eof_item.hpp"
+#include "../parse_cache.hpp"
+#include "../raw_item.hpp"
+#include "../../txt_reader.hpp"
+#include "../../txt_writer.hpp"
 
-#include <boost/algorithm/string/replace.hpp>
+#include <algorithm>
+#include <iterator>
+#include <boost/preprocessor/repetition/repeat.hpp>
 
 namespace Neptools
 {
 namespace Stsc
 {
 
-File::File(Source src)
+File::File(Source src, Flavor flavor) : flavor{flavor}
 {
+    TrackKind(ItemKind::STSC_STRING);
     AddInfo(&File::Parse_, ADD_SOURCE(src), this, src);
 }
 
+static NotNull<SmartPtr<Item>> CreateCachedItem(
+    Context& ctx, ItemKind kind, const Source& src, FilePosition)
+{
+    switch (kind)
+    {
+    case ItemKind::STSC_HEADER:
+        return ctx.Create<HeaderItem>(src);
+    case ItemKind::STSC_INSTRUCTION:
+        return InstructionBase::Create(ctx, src);
+    case ItemKind::STSC_STRING:
+        return ctx.Create<StringItem>(src);
+    default:
+        NEPTOOLS_THROW(DecodeError{"Stsc: invalid cached item"});
+    }
+}
+
 void File::Parse_(Source& src)
 {
+    ParseCache cache{*this, src, "stsc", static_cast<uint32_t>(flavor)};
+    if (cache.Restore(&CreateCachedItem)) return;
+
     auto root = Create<RawItem>(src);
     SetupParseFrom(*root);
     root->Split(root->GetSize(), Create<EofItem>());
     HeaderItem::CreateAndInsert({&*root, 0});
+    cache.Store();
 }
 
 static const char SEP_DASH[] = {
@@ -30,53 +57,97 @@ static const char SEP_DASH[] = {
     '\r', 0,
 };
 
-void File::WriteTxt_(std::ostream& os) const
+void File::WriteTxt_(TxtWriter& wr) const
 {
-    for (auto& it : GetChildren())
+    const StringView sep{SEP_DASH, sizeof(SEP_DASH) - 1};
+    for (auto it : GetTrackedItems(ItemKind::STSC_STRING))
     {
-        auto str = dynamic_cast<const StringItem*>(&it);
-        if (str)
-        {
-            os << boost::replace_all_copy(str->str, "\\n", "\r\n")
-               << "\r\n" << SEP_DASH << '\n';
-        }
+        wr.WriteLines(AssertedCast<const StringItem>(*it).str, "\\n");
+        wr.Write("\r\n");
+        wr.Write(sep);
+        wr.Write("\n");
     }
 }
 
-void File::ReadTxt_(std::istream& is)
+void File::ReadTxt_(TxtReader& rd)
 {
-    std::string line, msg;
-    auto it = GetChildren().begin();
-    auto end = GetChildren().end();
-    while (it != end && !dynamic_cast<StringItem*>(&*it)) ++it;
-
-    is.exceptions(std::ios_base::badbit);
-    while (!std::getline(is, line).fail())
+    const auto& strs = GetTrackedItems(ItemKind::STSC_STRING);
+    const StringView sep{SEP_DASH, sizeof(SEP_DASH) - 1};
+    size_t i = 0;
+    std::string buf;
+    StringView body, rest;
+    const char* begin = nullptr;
+    while (rd.Next(body, rest))
     {
-        if (line == SEP_DASH)
-        {
-            if (it == end)
-                NEPTOOLS_THROW(DecodeError{"StscTxt: too many strings"});
+        // only a line that is exactly SEP_DASH ends a message, other
+        // separator-like lines (UTF-8 dashes, trailing text) are part of it
+        if (!begin) begin = body.data();
+        if (!(rd.GetSeparatorLine() == sep)) continue;
+        body = {begin, size_t(body.data() + body.size() - begin)};
+        begin = nullptr;
 
-            NEPTOOLS_ASSERT(msg.empty() || msg.substr(msg.length()-2) == "\\n");
-            if (!msg.empty()) { msg.pop_back(); msg.pop_back(); }
-            static_cast<StringItem&>(*it).str = std::move(msg);
+        if (i == strs.size())
+            NEPTOOLS_THROW(DecodeError{"StscTxt: too many strings"});
 
-            ++it;
-            while (it != end && !dynamic_cast<StringItem*>(&*it)) ++it;
-
-            msg.clear();
-        }
-        else
+        auto msg = TxtReader::Normalize(body, "\\n", buf);
+        auto& str = AssertedCast<StringItem>(*strs[i++]);
+        if (str.str != msg)
         {
-            if (!line.empty() && line.back() == '\r') line.pop_back();
-            msg.append(line).append("\\n");
+            str.PrepareModify();
+            str.str = msg.to_string();
+            str.InvalidateSize();
         }
     }
 
-    if (it != end)
+    if (i != strs.size())
         NEPTOOLS_THROW(DecodeError{"StscTxt: not enough strings"});
 }
 
+// stsc strings store line ends as "\\n"
+static StringView ReplaceAll(StringView str, StringView from, StringView to,
+                             std::string& buf)
+{
+    auto ptr = str.data(), end = ptr + str.size();
+    auto p = std::search(ptr, end, from.begin(), from.end());
+    if (p == end) return str;
+
+    buf.clear();
+    for (; p != end; p = std::search(ptr, end, from.begin(), from.end()))
+    {
+        buf.append(ptr, p).append(to.data(), to.size());
+        ptr = p + from.size();
+    }
+    buf.append(ptr, end);
+    return buf;
+}
+
+void File::ForEachString_(const StringFun& fun) const
+{
+    std::string buf;
+    for (auto it : GetTrackedItems(ItemKind::STSC_STRING))
+        fun(ReplaceAll(AssertedCast<const StringItem>(*it).str, "\\n", "\n",
+                       buf));
+}
+
+size_t File::ReplaceStrings_(const ReplaceFun& fun)
+{
+    size_t count = 0;
+    std::string buf, out_buf;
+    StringView out;
+    for (auto it : GetTrackedItems(ItemKind::STSC_STRING))
+    {
+        auto& str = AssertedCast<StringItem>(*it);
+        if (!fun(ReplaceAll(str.str, "\\n", "\n", buf), out)) continue;
+        auto nstr = ReplaceAll(out, "\n", "\\n", out_buf);
+        if (nstr == str.str) continue;
+
+        str.PrepareModify();
+        str.str = nstr.to_string();
+        str.InvalidateSize();
+        ++count;
+    }
+    return count;
+}
+
 }
 }
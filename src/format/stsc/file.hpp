@@ -2,6 +2,7 @@
 #define UUID_CACA9E02_5122_4C09_9463_73AD33BA5802
 #pragma once
 
+#include "flavor.hpp"
 #include "../context.hpp"
 #include "../../source.hpp"
 #include "../../txt_serializable.hpp"
@@ -14,13 +15,18 @@ namespace Stsc
 class File : public Context, public TxtSerializable
 {
 public:
-    File(Source src);
+    File(Source src, Flavor flavor = Flavor::NOIRE);
+    Flavor GetFlavor() const noexcept { return flavor; }
 
 private:
     void Parse_(Source& src);
 
-    void WriteTxt_(std::ostream& os) const override;
-    void ReadTxt_(std::istream& is) override;
+    Flavor flavor;
+
+    void WriteTxt_(TxtWriter& wr) const override;
+    void ReadTxt_(TxtReader& rd) override;
+    void ForEachString_(const StringFun& fun) const override;
+    size_t ReplaceStrings_(const ReplaceFun& fun) override;
 };
 
 }
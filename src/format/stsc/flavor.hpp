@@ -0,0 +1,25 @@
+#ifndef UUID_E7F4BF7A_911E_4888_8769_47BCC5367FF5
+#define UUID_E7F4BF7A_911E_4888_8769_47BCC5367FF5
+#pragma once
+
+namespace Neptools
+{
+namespace Stsc
+{
+
+// Games (or versions of them) using different opcode tables. Each has its own
+// InstructionMap specializations in instruction.hpp.
+// x(enum name, command line name, description)
+#define NEPTOOLS_STSC_FLAVORS(x)                                        \
+    x(NOIRE, "noire", "Hyperdevotion Noire: Goddess Black Heart")
+
+enum class Flavor
+{
+#define NEPTOOLS_GEN_ENUM(c, _1, _2) c,
+    NEPTOOLS_STSC_FLAVORS(NEPTOOLS_GEN_ENUM)
+#undef NEPTOOLS_GEN_ENUM
+};
+
+}
+}
+#endif
@@ -14,6 +14,8 @@ namespace Stsc
 class HeaderItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STSC_HEADER;
+    using KindOwner = HeaderItem;
     struct Header
     {
         char magic[4];
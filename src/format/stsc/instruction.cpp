@@ -1,4 +1,5 @@
 #include "instruction.hpp"
+#include "file.hpp"
 #include "string.hpp"
 #include "../raw_item.hpp"
 #include "../../sink.hpp"
@@ -14,37 +15,52 @@ namespace
 using CreateType = NotNull<SmartPtr<InstructionBase>>
     (*)(Context&, const Source&);
 
-template <uint8_t I>
+template <Flavor F, uint8_t I>
 NotNull<SmartPtr<InstructionBase>>
 CreateAdapt(Context& ctx, const Source& src)
-{ return ctx.Create<InstructionItem<I>>(I, src); }
+{ return ctx.Create<InstructionItem<F, I>>(I, src); }
 
-template <typename T> struct CreateMapImpl;
-template <size_t... I>
-struct CreateMapImpl<std::index_sequence<I...>>
+template <Flavor F, typename T> struct CreateMapImpl;
+template <Flavor F, size_t... I>
+struct CreateMapImpl<F, std::index_sequence<I...>>
 {
-    static const constexpr CreateType MAP[] = { CreateAdapt<I>... };
+    static const constexpr CreateType MAP[] = { CreateAdapt<F, I>... };
 };
 
-template <size_t... I>
-const constexpr CreateType CreateMapImpl<std::index_sequence<I...>>::MAP[];
+template <Flavor F, size_t... I>
+const constexpr CreateType CreateMapImpl<F, std::index_sequence<I...>>::MAP[];
 
-using CreateMap = CreateMapImpl<std::make_index_sequence<256>>;
+template <Flavor F>
+using CreateMap = CreateMapImpl<F, std::make_index_sequence<256>>;
+
+// indexed by Flavor
+const CreateType* const CREATE_MAPS[] = {
+#define NEPTOOLS_GEN_MAP(c, _1, _2) CreateMap<Flavor::c>::MAP,
+    NEPTOOLS_STSC_FLAVORS(NEPTOOLS_GEN_MAP)
+#undef NEPTOOLS_GEN_MAP
+};
 }
 
 // base
 InstructionBase& InstructionBase::CreateAndInsert(ItemPointer ptr)
 {
     auto x = RawItem::GetSource(ptr, -1);
-    x.src.CheckSize(1);
-    uint8_t opcode = x.src.ReadLittleUint8();
     auto& ret = x.ritem.Split(
-        ptr.offset, CreateMap::MAP[opcode](x.ritem.GetUnsafeContext(), x.src));
+        ptr.offset, Create(x.ritem.GetUnsafeContext(), x.src));
 
     ret.PostInsert();
     return ret;
 }
 
+NotNull<RefCountedPtr<InstructionBase>> InstructionBase::Create(
+    Context& ctx, Source src)
+{
+    src.CheckSize(1);
+    uint8_t opcode = src.ReadLittleUint8();
+    auto flavor = asserted_cast<File&>(ctx).GetFlavor();
+    return CREATE_MAPS[static_cast<size_t>(flavor)][opcode](ctx, src);
+}
+
 void InstructionBase::InstrDump(Sink& sink) const
 {
     sink.WriteLittleUint8(opcode);
@@ -187,6 +203,12 @@ template<> struct Traits<Code*> : public Traits<void*>
     { MaybeCreateUnchecked<InstructionBase>(lbl->ptr); }
 };
 
+template <typename T, typename U>
+inline void AddTarget(std::vector<const Label*>&, const U&) {}
+template<> inline void AddTarget<Code*>(
+    std::vector<const Label*>& out, const Label* const& lbl)
+{ out.push_back(lbl); }
+
 template <typename T, typename... Args> struct OperationsImpl;
 template <typename... T, size_t... I>
 struct OperationsImpl<std::index_sequence<I...>, T...>
@@ -224,6 +246,13 @@ struct OperationsImpl<std::index_sequence<I...>, T...>
     static void PostInsert(const Tuple& tuple)
     { FORALL(Traits<T>::PostInsert(std::get<I>(tuple))); }
 
+    template <typename Tuple>
+    static void GetTargets(std::vector<const Label*>& out, const Tuple& tuple)
+    {
+        (void) out;
+        FORALL(AddTarget<T>(out, std::get<I>(tuple)));
+    }
+
     static constexpr size_t Size()
     {
         size_t sum = 0;
@@ -290,6 +319,11 @@ void SimpleInstruction<NoReturn, Args...>::PostInsert()
     if (!NoReturn) MaybeCreateUnchecked<InstructionBase>(&*++Iterator());
 }
 
+template <bool NoReturn, typename... Args>
+void SimpleInstruction<NoReturn, Args...>::GetTargets(
+    std::vector<const Label*>& out) const
+{ Operations<Args...>::GetTargets(out, args); }
+
 // ------------------------------------------------------------------------
 // specific instruction implementations
 Instruction0dItem::Instruction0dItem(
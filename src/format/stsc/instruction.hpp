@@ -2,6 +2,7 @@
 #define UUID_0A01B0B9_DA9A_4A05_919B_A5503594CA9D
 #pragma once
 
+#include "flavor.hpp"
 #include "../../source.hpp"
 #include "../item.hpp"
 #include <boost/endian/arithmetic.hpp>
@@ -14,13 +15,27 @@ namespace Stsc
 class InstructionBase : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STSC_INSTRUCTION;
+    using KindOwner = InstructionBase;
     InstructionBase(Key k, Context* ctx, uint8_t opcode)
         : Item{k, ctx}, opcode{opcode} {}
 
     static InstructionBase& CreateAndInsert(ItemPointer ptr);
+    // create the instruction starting at src, without inserting it. ctx must
+    // be a Stsc::File, its flavor selects the opcode table
+    static NotNull<RefCountedPtr<InstructionBase>> Create(
+        Context& ctx, Source src);
 
     uint8_t opcode;
 
+    // control flow: whether execution can continue with the next item, and
+    // the code this instruction can transfer control to (jumps and calls
+    // alike, the opcode tables don't tell them apart)
+    virtual bool IsNoReturn() const noexcept { return false; }
+    virtual void GetTargets(std::vector<const Label*>&) const {}
+    // bytes allocated by the instruction besides the object, for stats
+    virtual size_t GetHeapSize() const noexcept { return 0; }
+
 protected:
     void InstrDump(Sink& sink) const;
     std::ostream& InstrInspect(std::ostream& os) const;
@@ -45,6 +60,8 @@ public:
 
     static const FilePosition SIZE;
     FilePosition GetSize() const noexcept override { return SIZE; }
+    bool IsNoReturn() const noexcept override { return NoReturn; }
+    void GetTargets(std::vector<const Label*>& out) const override;
 
     std::tuple<typename TupleTypeMap<Args>::Type...> args;
 
@@ -60,6 +77,11 @@ class Instruction0dItem final : public InstructionBase
 public:
     Instruction0dItem(Key k, Context* ctx, uint8_t opcode, Source src);
     FilePosition GetSize() const noexcept override { return 2 + tgts.size()*4; }
+    bool IsNoReturn() const noexcept override { return true; }
+    void GetTargets(std::vector<const Label*>& out) const override
+    { out.insert(out.end(), tgts.begin(), tgts.end()); }
+    size_t GetHeapSize() const noexcept override
+    { return tgts.capacity() * sizeof(tgts[0]); }
 
     std::vector<const Label*> tgts;
 
@@ -110,6 +132,10 @@ public:
     Instruction1dItem(Key k, Context* ctx, uint8_t opcode, Source src);
     FilePosition GetSize() const noexcept override
     { return 1 + sizeof(FixParams) + tree.size() * sizeof(NodeParams); }
+    void GetTargets(std::vector<const Label*>& out) const override
+    { out.push_back(tgt); }
+    size_t GetHeapSize() const noexcept override
+    { return tree.capacity() * sizeof(Node); }
 
     const Label* tgt;
     struct Node
@@ -154,6 +180,10 @@ public:
     Instruction1eItem(Key k, Context* ctx, uint8_t opcode, Source src);
     FilePosition GetSize() const noexcept override
     { return 1 + sizeof(FixParams) + expressions.size() * sizeof(ExpressionParams); }
+    void GetTargets(std::vector<const Label*>& out) const override
+    { for (const auto& e : expressions) out.push_back(e.second); }
+    size_t GetHeapSize() const noexcept override
+    { return expressions.capacity() * sizeof(expressions[0]); }
 
     uint32_t field_0;
     bool flag;
@@ -169,16 +199,23 @@ private:
     void PostInsert() override;
 };
 
-// compile time map of opcode->instruction classes
-template <uint8_t Opcode> struct InstructionMap
-{ using Type = SimpleInstruction<false>; };
+// compile time map of opcode->instruction classes, one for each flavor. A
+// flavor similar to an existing one can derive its primary template from the
+// other flavor's map and only list the differing opcodes.
+template <Flavor F, uint8_t Opcode> struct InstructionMap;
 
-#define NEPTOOLS_OPCODE(id, ...)                \
-    template<> struct InstructionMap<id>        \
+#define NEPTOOLS_OPCODE(id, ...)                                \
+    template<> struct InstructionMap<NEPTOOLS_FLAVOR, id>       \
     { using Type = __VA_ARGS__; }
 #define NEPTOOLS_SIMPLE_OPCODE(id, ...)                 \
     NEPTOOLS_OPCODE(id, SimpleInstruction<__VA_ARGS__>)
 
+// ------------------------------------------------------------------------
+// Hyperdevotion Noire
+#define NEPTOOLS_FLAVOR Flavor::NOIRE
+template <uint8_t Opcode> struct InstructionMap<NEPTOOLS_FLAVOR, Opcode>
+{ using Type = SimpleInstruction<false>; };
+
 NEPTOOLS_SIMPLE_OPCODE(0x01, true);
 NEPTOOLS_SIMPLE_OPCODE(0x05, false, uint32_t);
 NEPTOOLS_SIMPLE_OPCODE(0x06, false, Code*);
@@ -345,12 +382,13 @@ NEPTOOLS_SIMPLE_OPCODE(0xf3, false, uint8_t, uint8_t);
 NEPTOOLS_SIMPLE_OPCODE(0xf4, false, std::string);
 NEPTOOLS_SIMPLE_OPCODE(0xf5, false, uint16_t, uint8_t);
 NEPTOOLS_SIMPLE_OPCODE(0xf7, false, uint16_t, uint8_t);
+#undef NEPTOOLS_FLAVOR
 
 #undef NEPTOOLS_OPCODE
 #undef NEPTOOLS_SIMPLE_OPCODE
 
-template <uint8_t Opcode>
-using InstructionItem = typename InstructionMap<Opcode>::Type;
+template <Flavor F, uint8_t Opcode>
+using InstructionItem = typename InstructionMap<F, Opcode>::Type;
 }
 }
 
@@ -17,6 +17,11 @@ StringItem& StringItem::CreateAndInsert(ItemPointer ptr)
     return x.ritem.SplitCreate<StringItem>(ptr.offset, x.src);
 }
 
+std::function<void ()> StringItem::SaveState()
+{
+    return [this, str = str]() { this->str = str; };
+}
+
 void StringItem::Dump_(Sink& sink) const
 {
     sink.WriteCString(str);
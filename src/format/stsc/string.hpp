@@ -13,6 +13,8 @@ namespace Stsc
 class StringItem final : public Item
 {
 public:
+    static constexpr ItemKind KIND = ItemKind::STSC_STRING;
+    using KindOwner = StringItem;
     StringItem(Key k, Context* ctx, Source src);
     static StringItem& CreateAndInsert(ItemPointer ptr);
     FilePosition GetSize() const noexcept override { return str.size() + 1; }
@@ -22,6 +24,7 @@ public:
 private:
     void Dump_(Sink& sink) const override;
     void Inspect_(std::ostream& os) const override;
+    std::function<void ()> SaveState() override;
 };
 
 }
@@ -0,0 +1,307 @@
+#include "translation_memory.hpp"
+#include "csv.hpp"
+#include "gbnl.hpp"
+#include "../except.hpp"
+#include "../sink.hpp"
+#include "../txt_reader.hpp"
+#include "../txt_writer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+namespace Neptools
+{
+
+static constexpr const char MAGIC[4] = {'N','P','T','M'};
+static constexpr uint32_t EMPTY_SLOT = -1;
+
+void TranslationMemory::Header::Validate(FilePosition file_size) const
+{
+#define VALIDATE(x) NEPTOOLS_VALIDATE_FIELD("TranslationMemory::Header", x)
+    VALIDATE(memcmp(magic, MAGIC, 4) == 0);
+    VALIDATE(slot_count != 0 && (slot_count & (slot_count - 1)) == 0);
+    VALIDATE(count < slot_count);
+    VALIDATE(sizeof(Header) + FilePosition(slot_count) * sizeof(Slot) +
+             pool_size == file_size);
+#undef VALIDATE
+}
+
+uint64_t TranslationMemory::Hash(StringView str) noexcept
+{ return Gbnl::OffsetString::Hash(str); }
+
+TranslationMemory::TranslationMemory(const Table& tbl)
+{
+    std::vector<const Slot*> slots;
+    slots.reserve(tbl.GetCount());
+    for (uint32_t i = 0; i < tbl.GetSlotCount(); ++i)
+        if (tbl.GetSlot(i).offset != EMPTY_SLOT)
+            slots.push_back(&tbl.GetSlot(i));
+    // the pool is in entry order
+    std::sort(slots.begin(), slots.end(), [](auto a, auto b)
+              { return a->source_offset < b->source_offset; });
+
+    entries.reserve(slots.size());
+    for (auto s : slots)
+    {
+        auto src = tbl.GetSource(*s);
+        if (FindEntry(src)) continue;
+        index.emplace(s->hash, entries.size());
+        entries.push_back({s->hash, src.to_string(),
+                           tbl.GetText(*s).to_string()});
+    }
+}
+
+const TranslationMemory::Entry* TranslationMemory::FindEntry(
+    StringView str) const
+{
+    auto rng = index.equal_range(Hash(str));
+    for (auto it = rng.first; it != rng.second; ++it)
+        if (str == entries[it->second].source) return &entries[it->second];
+    return nullptr;
+}
+
+bool TranslationMemory::Add(StringView str)
+{
+    if (FindEntry(str)) return false;
+    auto hash = Hash(str);
+    index.emplace(hash, entries.size());
+    entries.push_back({hash, str.to_string(), str.to_string()});
+    return true;
+}
+
+void TranslationMemory::Add(const TxtSerializable& txt)
+{
+    txt.ForEachString([this](StringView str) { Add(str); });
+}
+
+const std::string* TranslationMemory::Find(StringView str) const
+{
+    auto e = FindEntry(str);
+    return e ? &e->text : nullptr;
+}
+
+uint32_t TranslationMemory::GetSlotCount() const noexcept
+{
+    // at most half full, so probes stay short
+    uint32_t ret = 1;
+    while (ret < 2 * entries.size()) ret *= 2;
+    return ret;
+}
+
+FilePosition TranslationMemory::GetSize() const noexcept
+{
+    FilePosition ret = sizeof(Header) + GetSlotCount() * sizeof(Slot);
+    for (const auto& e : entries) ret += e.source.size() + e.text.size();
+    return ret;
+}
+
+void TranslationMemory::Dump_(Sink& sink) const
+{
+    auto slot_count = GetSlotCount();
+    std::vector<Slot> slots(slot_count);
+    for (auto& s : slots)
+    {
+        s.hash = 0;
+        s.source_offset = 0;
+        s.source_size = 0;
+        s.offset = EMPTY_SLOT;
+        s.size = 0;
+    }
+
+    FilePosition offset = 0;
+    for (const auto& e : entries)
+    {
+        if (offset + e.source.size() + e.text.size() >= EMPTY_SLOT)
+            NEPTOOLS_THROW(OutOfRange{"TranslationMemory: texts too long"});
+
+        auto i = e.hash & (slot_count - 1);
+        while (slots[i].offset != EMPTY_SLOT) i = (i + 1) & (slot_count - 1);
+        slots[i].hash = e.hash;
+        slots[i].source_offset = offset;
+        slots[i].source_size = e.source.size();
+        offset += e.source.size();
+        slots[i].offset = offset;
+        slots[i].size = e.text.size();
+        offset += e.text.size();
+    }
+
+    Header hdr;
+    memcpy(hdr.magic, MAGIC, 4);
+    hdr.slot_count = slot_count;
+    hdr.count = entries.size();
+    hdr.pool_size = offset;
+    sink.WriteGen(hdr);
+    sink.Write({reinterpret_cast<const char*>(slots.data()),
+                slots.size() * sizeof(Slot)});
+    for (const auto& e : entries)
+    {
+        sink.Write(e.source);
+        sink.Write(e.text);
+    }
+}
+
+void TranslationMemory::Inspect_(std::ostream& os) const
+{
+    os << "translation_memory[\n";
+    for (const auto& e : entries)
+    {
+        os << "    " << e.hash << ": ";
+        DumpBytes(os, e.source);
+        os << " -> ";
+        DumpBytes(os, e.text);
+        os << ",\n";
+    }
+    os << "]";
+}
+
+static const std::string& GetSeparator()
+{
+    static const std::string sep = []()
+    {
+        std::string ret;
+        for (int i = 0; i < 40; ++i) ret += "\xe2\x80\x95";
+        return ret + ' ';
+    }();
+    return sep;
+}
+
+// Like Gbnl's txt, with the hashes as ids. Colliding strings share an id, they
+// are read back in entry order.
+void TranslationMemory::WriteTxt_(TxtWriter& wr) const
+{
+    StringView sep = GetSeparator();
+    for (const auto& e : entries)
+    {
+        wr.Write(sep);
+        wr.WriteUint(e.hash);
+        wr.Write("\r\n");
+        wr.WriteLines(e.text, "\n");
+        wr.Write("\r\n");
+    }
+    wr.Write(sep);
+    wr.Write("EOF\r\n");
+}
+
+void TranslationMemory::ReadTxt_(TxtReader& rd)
+{
+    StringView body, rest;
+    std::string buf;
+    std::vector<bool> done(entries.size());
+    if (!rd.Next(body, rest))
+        NEPTOOLS_THROW(DecodeError{"TmTxt: EOF"});
+    if (!body.empty())
+        NEPTOOLS_THROW(DecodeError{"TmTxt: data before separator"});
+
+    while (true)
+    {
+        if (!rest.empty() && rest[0] == ' ') rest.remove_prefix(1);
+        if (rest.size() >= 3 && memcmp(rest.data(), "EOF", 3) == 0) return;
+
+        uint64_t hash;
+        if (!Csv::ParseUint(rest, -1, hash))
+            NEPTOOLS_THROW(DecodeError{"TmTxt: invalid hash"});
+        // the first entry with this hash not read yet
+        auto rng = index.equal_range(hash);
+        size_t i = -1;
+        for (auto it = rng.first; it != rng.second; ++it)
+            if (!done[it->second] && it->second < i) i = it->second;
+        if (i == size_t(-1))
+            NEPTOOLS_THROW(DecodeError{"TmTxt: unknown hash"} <<
+                           FailedHash{hash});
+        done[i] = true;
+
+        if (!rd.Next(body, rest))
+            NEPTOOLS_THROW(DecodeError{"TmTxt: EOF"});
+        entries[i].text = TxtReader::Normalize(body, "\n", buf).to_string();
+    }
+}
+
+void TranslationMemory::ForEachString_(const StringFun& fun) const
+{
+    for (const auto& e : entries) fun(e.text);
+}
+
+size_t TranslationMemory::ReplaceStrings_(const ReplaceFun& fun)
+{
+    size_t count = 0;
+    StringView out;
+    for (auto& e : entries)
+        if (fun(e.text, out) && !(out == e.text))
+        {
+            e.text = out.to_string();
+            ++count;
+        }
+    return count;
+}
+
+
+TranslationMemory::Table::Table(Source src_)
+{
+    Header hdr;
+    src_.CheckSize(sizeof(Header));
+    src_.PreadGen(0, hdr);
+    auto size = src_.GetSize();
+    hdr.Validate(size);
+
+    if (src_.GetResidentData())
+    {
+        src = std::move(src_);
+        data = src->GetResidentData();
+    }
+    else
+    {
+        buf.resize(size);
+        src_.Pread(0, &buf[0], size);
+        data = buf.data();
+    }
+    slot_count = hdr.slot_count;
+    count = hdr.count;
+    pool = data + sizeof(Header) + FilePosition(slot_count) * sizeof(Slot);
+    pool_size = hdr.pool_size;
+}
+
+TranslationMemory::Table::Table(const boost::filesystem::path& fname)
+    : Table{Source::FromFile(fname)} {}
+
+StringView TranslationMemory::Table::GetSource(const Slot& slot) const
+{
+    uint32_t offset = slot.source_offset, size = slot.source_size;
+    if (offset > pool_size || size > pool_size - offset)
+        NEPTOOLS_THROW(DecodeError{"TranslationMemory: invalid slot"});
+    return {pool + offset, size};
+}
+
+StringView TranslationMemory::Table::GetText(const Slot& slot) const
+{
+    uint32_t offset = slot.offset, size = slot.size;
+    if (offset > pool_size || size > pool_size - offset)
+        NEPTOOLS_THROW(DecodeError{"TranslationMemory: invalid slot"});
+    return {pool + offset, size};
+}
+
+bool TranslationMemory::Table::Find(StringView str, StringView& out) const
+{
+    auto hash = Hash(str);
+    auto mask = slot_count - 1;
+    auto i = static_cast<uint32_t>(hash & mask);
+    // a valid table always has an empty slot, don't loop forever otherwise
+    for (uint32_t n = 0; n < slot_count; ++n, i = (i + 1) & mask)
+    {
+        const auto& s = GetSlot(i);
+        if (s.offset == EMPTY_SLOT) return false;
+        if (s.hash == hash && GetSource(s) == str)
+        {
+            out = GetText(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TranslationMemory::Table::Apply(TxtSerializable& txt) const
+{
+    return txt.ReplaceStrings([this](StringView str, StringView& out)
+                              { return Find(str, out); });
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef UUID_ED782B54_8AE5_456A_B6E5_EC146B7CB0C6
+#define UUID_ED782B54_8AE5_456A_B6E5_EC146B7CB0C6
+#pragma once
+
+#include "../dumpable.hpp"
+#include "../source.hpp"
+#include "../txt_serializable.hpp"
+#include <boost/endian/arithmetic.hpp>
+#include <boost/optional.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Neptools
+{
+
+// Content-addressed string table shared by the files of a game: a source
+// string -> its text, looked up by the hash of the source string. The texts
+// start out as the source strings themselves, are translated through
+// WriteTxt/ReadTxt, then applied to every file with Table::Apply. The dumped
+// form is an open addressing hash table that Table looks up in place, without
+// loading it.
+class TranslationMemory final : public Dumpable, public TxtSerializable
+{
+public:
+    struct Header
+    {
+        char magic[4];
+        boost::endian::little_uint32_t slot_count; // power of two
+        boost::endian::little_uint32_t count;
+        boost::endian::little_uint32_t pool_size;
+
+        void Validate(FilePosition file_size) const;
+    };
+    NEPTOOLS_STATIC_ASSERT(sizeof(Header) == 0x10);
+
+    // slot_count of these follow the header, then pool_size bytes of source
+    // strings and texts in entry order. The source is kept, different strings
+    // can have the same hash.
+    struct Slot
+    {
+        boost::endian::little_uint64_t hash;
+        boost::endian::little_uint32_t source_offset; // in the pool
+        boost::endian::little_uint32_t source_size;
+        boost::endian::little_uint32_t offset; // in the pool, -1: empty
+        boost::endian::little_uint32_t size;
+    };
+    NEPTOOLS_STATIC_ASSERT(sizeof(Slot) == 0x18);
+
+    struct Entry
+    {
+        uint64_t hash;
+        std::string source;
+        std::string text;
+    };
+
+    // FNV-1a, like Gbnl
+    static uint64_t Hash(StringView str) noexcept;
+
+    class Table;
+
+    TranslationMemory() = default;
+    // loads a dumped memory
+    explicit TranslationMemory(const Table& tbl);
+
+    // Adds str, unless it's already known (then it keeps the existing, maybe
+    // translated text). Returns whether str was added.
+    bool Add(StringView str);
+    void Add(const TxtSerializable& txt);
+    // the text of source str, nullptr if not found
+    const std::string* Find(StringView str) const;
+
+    // in the order they were added
+    const std::vector<Entry>& GetEntries() const noexcept { return entries; }
+
+    FilePosition GetSize() const noexcept override;
+
+    using FailedHash = boost::error_info<struct FailedHashTag, uint64_t>;
+
+private:
+    void Dump_(Sink& sink) const override;
+    void Inspect_(std::ostream& os) const override;
+
+    void WriteTxt_(TxtWriter& wr) const override;
+    void ReadTxt_(TxtReader& rd) override;
+    void ForEachString_(const StringFun& fun) const override;
+    size_t ReplaceStrings_(const ReplaceFun& fun) override;
+
+    uint32_t GetSlotCount() const noexcept;
+    const Entry* FindEntry(StringView str) const;
+
+    std::vector<Entry> entries;
+    // hash -> entries index, colliding strings have more than one
+    std::unordered_multimap<uint64_t, size_t> index;
+};
+
+// Read-only view of a dumped TranslationMemory. The file is mapped when
+// possible, lookups only touch the probed slots and the found text.
+class TranslationMemory::Table
+{
+public:
+    explicit Table(Source src);
+    explicit Table(const boost::filesystem::path& fname);
+
+    Table(const Table&) = delete;
+    void operator=(const Table&) = delete;
+
+    uint32_t GetCount() const noexcept { return count; }
+    uint32_t GetSlotCount() const noexcept { return slot_count; }
+    const Slot& GetSlot(uint32_t i) const noexcept
+    { return reinterpret_cast<const Slot*>(data + sizeof(Header))[i]; }
+    StringView GetSource(const Slot& slot) const;
+    StringView GetText(const Slot& slot) const;
+
+    // the text of source str
+    bool Find(StringView str, StringView& out) const;
+
+    // Replaces every string of txt found in the table, returns the number of
+    // strings changed.
+    size_t Apply(TxtSerializable& txt) const;
+
+private:
+    boost::optional<Source> src;
+    std::string buf;
+    const char* data;
+    uint32_t slot_count, count;
+    const char* pool;
+    uint32_t pool_size;
+};
+
+}
+#endif
@@ -187,7 +187,7 @@ bool CpkHandler::OpenTxtFile(
             txt = static_cast<Gbnl*>(dmp.get());
         }
 
-        txt->ReadTxt(OpenIn(pthtxt));
+        txt->ReadTxt(pthtxt);
         dmp->Fixup();
         size = dmp->GetSize();
         buf.reset(new Byte[size]);
@@ -1,16 +1,27 @@
 #include "../format/item.hpp"
 #include "../format/cl3.hpp"
+#include "../format/gbnl_query.hpp"
+#include "../format/parse_cache.hpp"
+#include "../format/stats.hpp"
 #include "../format/stcm/file.hpp"
 #include "../format/stcm/gbnl.hpp"
+#include "../format/stcm/xref.hpp"
+#include "../format/stsc/cfg.hpp"
 #include "../format/stsc/file.hpp"
+#include "../format/translation_memory.hpp"
 #include "../except.hpp"
 #include "../options.hpp"
 #include "../txt_serializable.hpp"
+#include "../txt_writer.hpp"
 #include "../utils.hpp"
 #include "version.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <deque>
+#include <new>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/exception/errinfo_file_name.hpp>
 #include <boost/filesystem/path.hpp>
@@ -21,8 +32,75 @@
 
 using namespace Neptools;
 
+#ifndef NDEBUG
+// count heap usage for --stats. every block is prefixed with its size
 namespace
 {
+constexpr size_t ALLOC_HEADER = alignof(std::max_align_t);
+std::atomic<size_t> alloc_count{0}, alloc_live_count{0}, alloc_live_bytes{0},
+    alloc_peak_bytes{0};
+}
+
+void* operator new(std::size_t size)
+{
+    auto ptr = static_cast<char*>(std::malloc(size + ALLOC_HEADER));
+    if (!ptr) throw std::bad_alloc{};
+    *reinterpret_cast<std::size_t*>(ptr) = size;
+
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_live_count.fetch_add(1, std::memory_order_relaxed);
+    auto live = alloc_live_bytes.fetch_add(size, std::memory_order_relaxed) +
+        size;
+    auto peak = alloc_peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !alloc_peak_bytes.compare_exchange_weak(
+               peak, live, std::memory_order_relaxed));
+    return ptr + ALLOC_HEADER;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr) return;
+    auto base = static_cast<char*>(ptr) - ALLOC_HEADER;
+    alloc_live_count.fetch_sub(1, std::memory_order_relaxed);
+    alloc_live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(base),
+                               std::memory_order_relaxed);
+    std::free(base);
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept
+{ operator delete(ptr); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return operator new(size); }
+    catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t& nt) noexcept
+{ return operator new(size, nt); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{ operator delete(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{ operator delete(ptr); }
+#endif
+
+namespace
+{
+
+void PrintAllocStats(std::ostream& os)
+{
+#ifndef NDEBUG
+    os << "heap: " << alloc_live_count << " blocks, " << alloc_live_bytes
+       << " bytes live, " << alloc_peak_bytes << " bytes peak, "
+       << alloc_count << " allocations total\n";
+#else
+    (void) os;
+#endif
+}
+
+Stsc::Flavor stsc_flavor = Stsc::Flavor::NOIRE;
 
 struct State
 {
@@ -51,7 +129,7 @@ State SmartOpen_(const boost::filesystem::path& fname)
     }
     else if (memcmp(buf, "STSC", 4) == 0)
     {
-        auto stsc = MakeSmart<Stsc::File>(src);
+        auto stsc = MakeSmart<Stsc::File>(src, stsc_flavor);
         return {stsc, nullptr, nullptr, stsc.get()};
     }
     else if (src.GetSize() >= sizeof(Gbnl::Header) &&
@@ -108,6 +186,22 @@ void EnsureStcm(State& st)
     st.stcm = &st.cl3->GetStcm();
 }
 
+Stsc::File& GetStsc(State& st)
+{
+    if (!st.dump) throw InvalidParam{"no file loaded"};
+    auto stsc = dynamic_cast<Stsc::File*>(st.dump.get());
+    if (!stsc) throw InvalidParam{"invalid file loaded: not an STSC"};
+    return *stsc;
+}
+
+Gbnl& GetGbnl(State& st)
+{
+    if (!st.dump) throw InvalidParam{"no file loaded"};
+    auto gbnl = dynamic_cast<Gbnl*>(st.dump.get());
+    if (!gbnl) throw InvalidParam{"invalid file loaded: not a GBNL"};
+    return *gbnl;
+}
+
 void EnsureTxt(State& st)
 {
     if (st.txt) return;
@@ -117,6 +211,42 @@ void EnsureTxt(State& st)
     st.txt = st.stcm;
 }
 
+// export-only fast path: find the GBNLs without parsing the whole STCM.
+// returns an empty vector if the file needs the normal path
+std::vector<NotNull<SmartPtr<Gbnl>>> FastScanGbnl(
+    const boost::filesystem::path& in)
+{
+    auto src = Source::FromFile(in.native());
+    src.CheckSize(4);
+
+    char buf[4];
+    src.Pread(0, buf, 4);
+    if (memcmp(buf, "CL3B", 4) == 0)
+    {
+        Cl3 cl3{src};
+        auto dat = cl3.entries.find("main.DAT", std::less<>{});
+        if (dat == cl3.entries.end() || !dat->src) return {};
+        src = *asserted_cast<DumpableSource*>(dat->src.get());
+    }
+    else if (memcmp(buf, "STCM", 4) != 0)
+        return {};
+
+    return Stcm::File::ScanGbnl(src);
+}
+
+bool FastExportTxt(const boost::filesystem::path& in,
+                   const boost::filesystem::path& txt)
+{
+    auto gbnls = FastScanGbnl(in);
+    if (gbnls.empty()) return false;
+
+    TxtWriter wr{txt};
+    for (const auto& g : gbnls)
+        g->WriteTxt(wr);
+    wr.Flush();
+    return true;
+}
+
 bool auto_failed = false;
 template <typename Pred, typename Fun>
 void RecDo(const boost::filesystem::path& path, Pred p, Fun f, bool rec = false)
@@ -169,19 +299,21 @@ void DoAutoFun(const boost::filesystem::path& p)
         txt += ".txt";
         import = false;
         INFO << "Exporting: " << cl3 << " -> " << txt << std::endl;
+        if (FastExportTxt(cl3, txt)) return;
+        DBG(1) << "Fast export failed, parsing " << cl3 << std::endl;
     }
 
     auto st = SmartOpen(cl3);
     EnsureTxt(st);
     if (import)
     {
-        st.txt->ReadTxt(OpenIn(txt));
+        st.txt->ReadTxt(txt);
         if (st.stcm) st.stcm->Fixup();
         st.dump->Fixup();
         st.dump->Dump(cl3);
     }
     else
-        st.txt->WriteTxt(OpenOut(txt));
+        st.txt->WriteTxt(txt);
 }
 
 void DoAutoCl3(const boost::filesystem::path& p)
@@ -221,6 +353,13 @@ bool IsBin(const boost::filesystem::path& p, bool = false)
         boost::iends_with(p.native(), ".bin"));
 }
 
+bool IsGbnl(const boost::filesystem::path& p, bool = false)
+{
+    return is_file(p) && (
+        boost::iends_with(p.native(), ".gbin") ||
+        boost::iends_with(p.native(), ".gstr"));
+}
+
 bool IsTxt(const boost::filesystem::path& p, bool = false)
 {
     return is_file(p) && (
@@ -241,6 +380,75 @@ bool IsCl3Dir(const boost::filesystem::path& p, bool = false)
         boost::iends_with(p.native(), ".cl3.out");
 }
 
+// opens p for the translation memory, false if it has no text
+bool OpenTxt(const boost::filesystem::path& p, State& st)
+{
+    try
+    {
+        st = SmartOpen(p);
+        EnsureTxt(st);
+        return true;
+    }
+    catch (const std::exception&)
+    {
+        DBG(1) << "Skipping " << p << ": " << ExceptionToString() << std::endl;
+        return false;
+    }
+}
+
+void TmExport(const boost::filesystem::path& dir,
+              const boost::filesystem::path& tm_file)
+{
+    // sorted, so the memory doesn't depend on the directory order
+    std::vector<boost::filesystem::path> files;
+    RecDo(dir, IsBin, [&](auto& p) { files.push_back(p); });
+    std::sort(files.begin(), files.end());
+
+    TranslationMemory tm;
+    for (const auto& p : files)
+    {
+        // the scan finds the same GBNLs as OpenTxt's full parse
+        try
+        {
+            auto gbnls = FastScanGbnl(p);
+            if (!gbnls.empty())
+            {
+                for (const auto& g : gbnls) tm.Add(*g);
+                continue;
+            }
+        }
+        catch (const std::exception&)
+        {
+            DBG(1) << "Scan failed " << p << ": " << ExceptionToString()
+                   << std::endl;
+        }
+
+        State st;
+        if (OpenTxt(p, st)) tm.Add(*st.txt);
+    }
+    INFO << tm.GetEntries().size() << " unique strings from " << files.size()
+         << " files" << std::endl;
+    tm.Dump(tm_file);
+}
+
+void TmImport(const boost::filesystem::path& tm_file,
+              const boost::filesystem::path& dir)
+{
+    TranslationMemory::Table tbl{tm_file};
+    RecDo(dir, IsBin, [&](auto& p)
+    {
+        State st;
+        if (!OpenTxt(p, st)) return;
+        auto n = tbl.Apply(*st.txt);
+        if (n == 0) return;
+
+        INFO << "Translating: " << p << " (" << n << " strings)" << std::endl;
+        if (st.stcm) st.stcm->Fixup();
+        st.dump->Fixup();
+        st.dump->Dump(p);
+    });
+}
+
 void DoAuto(const boost::filesystem::path& path)
 {
     bool (*pred)(const boost::filesystem::path&, bool);
@@ -321,6 +529,26 @@ int main(int argc, char** argv)
             if (0);
 #define GEN_IFS(c, str, _) else if (strcmp(args.front(), str) == 0) mode = Mode::c;
             MODE_PARS(GEN_IFS)
+#undef GEN_IFS
+            else throw InvalidParam{"invalid argument"};
+        }};
+    Option parse_cache_opt{
+        hgrp, "parse-cache", 1, "DIR",
+        "Cache parsed stcm/stsc files in DIR, so opening them again is faster "
+        "(affects files opened after this option)",
+        [](auto&& args) { ParseCache::SetDirectory(args.front()); }};
+    Option stsc_flavor_opt{
+        hgrp, "stsc-flavor", 1, "NAME",
+#define GEN_HELP(_, key, help) "\t\t" key ": " help "\n"
+        "Set the game of stsc files opened after this option:\n"
+        NEPTOOLS_STSC_FLAVORS(GEN_HELP),
+#undef GEN_HELP
+        [](auto&& args)
+        {
+            if (0);
+#define GEN_IFS(c, str, _) \
+            else if (strcmp(args.front(), str) == 0) stsc_flavor = Stsc::Flavor::c;
+            NEPTOOLS_STSC_FLAVORS(GEN_IFS)
 #undef GEN_IFS
             else throw InvalidParam{"invalid argument"};
         }};
@@ -466,6 +694,87 @@ int main(int argc, char** argv)
             EnsureStcm(st);
             ShellInspect(st.stcm, args.front());
         }};
+    Option xref_opt{
+        lgrp, "xref", 1, "LABEL",
+        "Lists the calls, instruction parameters and exports referencing "
+        "LABEL in the currently loaded file",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            EnsureStcm(st);
+            Stcm::XrefIndex{*st.stcm}.WriteRefs(
+                std::cout, st.stcm->GetLabel(args.front()));
+        }};
+    Option call_graph_opt{
+        lgrp, "call-graph", 1, "OUT|-",
+        "Writes the call graph of the currently loaded file into OUT or stdout "
+        "in graphviz format",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            EnsureStcm(st);
+            auto graph = Stcm::XrefIndex{*st.stcm}.GetCallGraph();
+            ShellInspectGen(&graph, args.front(), [](auto x, auto&& os)
+            { Stcm::XrefIndex::WriteDot(os, *x); });
+        }};
+    Option call_graph_json_opt{
+        lgrp, "call-graph-json", 1, "OUT|-",
+        "Writes the call graph of the currently loaded file into OUT or stdout "
+        "as json",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            EnsureStcm(st);
+            auto graph = Stcm::XrefIndex{*st.stcm}.GetCallGraph();
+            ShellInspectGen(&graph, args.front(), [](auto x, auto&& os)
+            { Stcm::XrefIndex::WriteJson(os, *x); });
+        }};
+    Option stsc_cfg_opt{
+        lgrp, "stsc-cfg", 1, "OUT|-",
+        "Writes the basic blocks of the currently loaded STSC into OUT or "
+        "stdout in graphviz format, unreachable blocks dashed",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            Stsc::Cfg cfg{GetStsc(st)};
+            ShellInspectGen(&cfg, args.front(), [](auto x, auto&& os)
+            { x->WriteDot(os); });
+        }};
+    Option stsc_dead_code_opt{
+        lgrp, "stsc-dead-code", 1, "OUT|-",
+        "Lists the unreachable blocks and unparsed regions of the currently "
+        "loaded STSC into OUT or stdout",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            Stsc::Cfg cfg{GetStsc(st)};
+            ShellInspectGen(&cfg, args.front(), [](auto x, auto&& os)
+            { x->WriteDeadCode(os); });
+        }};
+    Option stats_opt{
+        lgrp, "stats", 1, "OUT|-",
+        "Prints item counts and memory usage of the currently loaded file "
+        "into OUT or stdout (heap totals only in debug builds)",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            if (!st.dump) throw InvalidParam{"No file loaded"};
+            if (st.cl3) EnsureStcm(st);
+
+            ContextStats stats;
+            if (st.stcm)
+                stats.Add(*st.stcm);
+            else if (auto ctx = dynamic_cast<const Context*>(st.dump.get()))
+                stats.Add(*ctx);
+            else if (auto gbnl = dynamic_cast<const Gbnl*>(st.dump.get()))
+                stats.Add(*gbnl);
+
+            ShellInspectGen(&stats, args.front(), [](auto x, auto&& os)
+            {
+                os << *x;
+                PrintAllocStats(os);
+            });
+        }};
     Option parse_stcmp_opt{
         lgrp, "parse-stcm", 0, nullptr,
         "Parse STCM-inside-CL3 (usually done automatically)",
@@ -475,6 +784,59 @@ int main(int argc, char** argv)
             EnsureStcm(st);
         }};
 
+    Option query_gbnl_opt{
+        lgrp, "query-gbnl", 2, "QUERY FILE|DIR",
+        "Prints the rows of every gbin/gstr in FILE or DIR matching QUERY, "
+        "like 'cols=0,5 where 0>100', tab separated (see README)",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            GbnlQuery query{args[0]};
+            std::vector<boost::filesystem::path> files;
+            RecDo(args[1], IsGbnl, [&](auto& p) { files.push_back(p); });
+            if (!query.Run(files, std::cout)) auto_failed = true;
+        }};
+
+    Option tm_export_opt{
+        lgrp, "tm-export", 2, "DIR TM_FILE",
+        "Collects the strings of every cl3/gbin/gstr/bin file in DIR into "
+        "translation memory TM_FILE, each distinct string once",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            TmExport(args[0], args[1]);
+        }};
+    Option tm_export_txt_opt{
+        lgrp, "tm-export-txt", 2, "TM_FILE OUT_FILE|-",
+        "Exports the texts of translation memory TM_FILE to OUT_FILE or stdout",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            TranslationMemory tm{TranslationMemory::Table{args[0]}};
+            ShellInspectGen(&tm, args[1],
+                            [](auto& x, auto&& y) { x->WriteTxt(y); });
+        }};
+    Option tm_import_txt_opt{
+        lgrp, "tm-import-txt", 2, "TM_FILE IN_FILE",
+        "Replaces the texts of translation memory TM_FILE with the ones in "
+        "IN_FILE",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            TranslationMemory tm{TranslationMemory::Table{args[0]}};
+            tm.ReadTxt(boost::filesystem::path{args[1]});
+            tm.Dump(args[0]);
+        }};
+    Option tm_import_opt{
+        lgrp, "tm-import", 2, "TM_FILE DIR",
+        "Applies translation memory TM_FILE to every cl3/gbin/gstr/bin file "
+        "in DIR, rewriting the changed ones",
+        [&](auto&& args)
+        {
+            mode = Mode::MANUAL;
+            TmImport(args[0], args[1]);
+        }};
+
     Option export_txt_opt{
         lgrp, "export-txt", 1, "OUT_FILE|-", "Export text to OUT_FILE or stdout",
         [&](auto&& args)
@@ -494,10 +856,45 @@ int main(int argc, char** argv)
             if (fname[0] == '-' && fname[1] == '\0')
                 st.txt->ReadTxt(std::cin);
             else
-                st.txt->ReadTxt(OpenIn(fname));
+                st.txt->ReadTxt(boost::filesystem::path{fname});
             if (st.stcm) st.stcm->Fixup();
         }};
 
+    auto export_csv = [&](auto&& args, char sep)
+    {
+        mode = Mode::MANUAL;
+        ShellInspectGen(&GetGbnl(st), args.front(), [sep](auto x, auto&& os)
+        { x->WriteCsv(os, sep); });
+    };
+    auto import_csv = [&](auto&& args, char sep)
+    {
+        mode = Mode::MANUAL;
+        auto& gbnl = GetGbnl(st);
+        auto fname = args.front();
+        if (fname[0] == '-' && fname[1] == '\0')
+            gbnl.ReadCsv(std::cin, sep);
+        else
+            gbnl.ReadCsv(OpenIn(fname), sep);
+    };
+    Option export_csv_opt{
+        lgrp, "export-csv", 1, "OUT_FILE|-",
+        "Export every column of the loaded gbin/gstr to OUT_FILE or stdout as "
+        "csv",
+        [&](auto&& args) { export_csv(args, ','); }};
+    Option import_csv_opt{
+        lgrp, "import-csv", 1, "IN_FILE|-",
+        "Replace the messages of the loaded gbin/gstr with a csv from "
+        "IN_FILE or stdin",
+        [&](auto&& args) { import_csv(args, ','); }};
+    Option export_tsv_opt{
+        lgrp, "export-tsv", 1, "OUT_FILE|-",
+        "Like --export-csv, but tab separated",
+        [&](auto&& args) { export_csv(args, '\t'); }};
+    Option import_tsv_opt{
+        lgrp, "import-tsv", 1, "IN_FILE|-",
+        "Like --import-csv, but tab separated",
+        [&](auto&& args) { import_csv(args, '\t'); }};
+
     boost::filesystem::path self{argv[0]};
     if (boost::iequals(self.filename().string(), "cl3-tool")
 #ifdef WINDOWS
@@ -54,6 +54,19 @@ public:
         if (len) Pad_(len);
     }
 
+    // The next len bytes of the output to fill in directly, if they fit into
+    // the current buffer, nullptr otherwise (use Write in that case).
+    template <typename Checker = Check::Assert>
+    Byte* Claim(FileMemSize len)
+    {
+        NEPTOOLS_CHECK(SinkOverflow, offset+buf_put+len <= size,
+                       "Sink overflow during claim");
+        if (buf_size - buf_put < len) return nullptr;
+        auto ret = buf + buf_put;
+        buf_put += len;
+        return ret;
+    }
+
     virtual void Flush() {}
 
 #define NEPTOOLS_GEN(bits)                                                  \
@@ -48,6 +48,25 @@ struct UnixProvider final : public UnixLike<UnixProvider>
     void DeleteChunk(size_t i);
 };
 
+struct MemoryProvider final : public Source::Provider
+{
+    MemoryProvider(std::unique_ptr<char[]> data,
+                   boost::filesystem::path file_name, FilePosition size)
+        : Source::Provider{std::move(file_name), size}, data{std::move(data)}
+    {
+        resident = reinterpret_cast<Byte*>(this->data.get());
+        LruPush(reinterpret_cast<Byte*>(this->data.get()), 0, size);
+    }
+
+    void Pread(FilePosition offs, Byte* buf, FileMemSize len) override
+    {
+        NEPTOOLS_ASSERT(offs <= size && offs + len <= size);
+        memcpy(buf, data.get() + offs, len);
+    }
+
+    std::unique_ptr<char[]> data;
+};
+
 }
 
 
@@ -76,6 +95,13 @@ Source Source::FromFile_(boost::filesystem::path fname)
     return {MakeNotNull(std::move(p)), size};
 }
 
+Source Source::FromMemory(boost::filesystem::path fname,
+                          std::unique_ptr<char[]> data, FilePosition len)
+{
+    return {MakeSmart<MemoryProvider>(std::move(data), std::move(fname), len),
+            len};
+}
+
 void Source::Pread_(FilePosition offs, Byte* buf, FileMemSize len) const
 {
     offs += offset;
@@ -190,6 +216,8 @@ MmapProvider::MmapProvider(
     lru[0].ptr = static_cast<Byte*>(ptr);
     lru[0].offset = 0;
     lru[0].size = to_map;
+    // never evicted, every offset is in this chunk
+    if (to_map == size) resident = lru[0].ptr;
 }
 
 void* MmapProvider::ReadChunk(FilePosition offs, FileMemSize size)
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <boost/endian/arithmetic.hpp>
 #include <boost/exception/info.hpp>
 #include <boost/exception/get_error_info.hpp>
@@ -39,6 +40,10 @@ public:
         : Source{s} { Slice(offset, size); get = 0; }
 
     static Source FromFile(boost::filesystem::path fname);
+    static Source FromMemory(std::unique_ptr<char[]> data, FilePosition len)
+    { return FromMemory("", std::move(data), len); }
+    static Source FromMemory(boost::filesystem::path fname,
+                             std::unique_ptr<char[]> data, FilePosition len);
 
     template <typename Checker = Check::Assert>
     void Slice(FilePosition offset, FilePosition size) noexcept
@@ -57,6 +62,15 @@ public:
 
     FilePosition GetSize() const noexcept { return size; }
 
+    // The data of this source if it stays in memory as long as the source
+    // (or a copy of it) is alive: memory sources and files mapped in one
+    // piece. nullptr otherwise.
+    const char* GetResidentData() const noexcept
+    {
+        return p->resident ?
+            reinterpret_cast<const char*>(p->resident) + offset : nullptr;
+    }
+
     template <typename Checker = Check::Assert>
     void Seek(FilePosition pos) noexcept
     {
@@ -151,7 +165,7 @@ public:
             str.append(buf, len);
             if (len < rd)
             {
-                Seek(Tell() - (rd-len+1));
+                Seek(Tell() - (rd-len-1));
                 break;
             }
         }
@@ -196,6 +210,8 @@ public:
         std::array<BufEntry, 4> lru;
         boost::filesystem::path file_name;
         FilePosition size;
+        // the whole data, if it stays in memory while the provider lives
+        const Byte* resident = nullptr;
     };
     Source(NotNull<SmartPtr<Provider>> p, FilePosition size)
         : size{size}, p{std::move(p)} {}
@@ -0,0 +1,153 @@
+#include "txt_reader.hpp"
+#include "txt_serializable.hpp"
+#include <cstring>
+#include <istream>
+#include <iterator>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace Neptools
+{
+
+namespace
+{
+
+constexpr size_t SEP_COUNT = 40;
+constexpr const char SEP_SJIS[] = "\x81\x5c";
+constexpr const char SEP_UTF8[] = "\xe2\x80\x95";
+
+// length of the dashes at ptr, or 0
+size_t MatchSeparator(const char* ptr, size_t size) noexcept
+{
+    for (StringView unit : {StringView{SEP_SJIS}, StringView{SEP_UTF8}})
+    {
+        auto len = SEP_COUNT * unit.size();
+        if (size < len || ptr[0] != unit[0]) continue;
+        size_t i = 0;
+        for (; i < len; i += unit.size())
+            if (memcmp(ptr + i, unit.data(), unit.size()) != 0) break;
+        if (i == len) return len;
+    }
+    return 0;
+}
+
+// Position of the first separator line starting after pos (which is the
+// start of a line), or size. Only positions after a '\n' starting with the
+// first byte of a separator need a closer look.
+size_t FindSeparator(const char* data, size_t size, size_t pos,
+                     size_t& sep_len) noexcept
+{
+    auto check = [&](size_t i)
+    { return (sep_len = MatchSeparator(data + i, size - i)); };
+    if (pos < size && check(pos)) return pos;
+
+    size_t i = pos + 1;
+#ifdef __SSE2__
+    auto nl = _mm_set1_epi8('\n');
+    auto sjis = _mm_set1_epi8(SEP_SJIS[0]), utf8 = _mm_set1_epi8(SEP_UTF8[0]);
+    for (; i + 16 <= size; i += 16)
+    {
+        auto cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto prev = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(data + i - 1));
+        auto first = _mm_or_si128(_mm_cmpeq_epi8(cur, sjis),
+                                  _mm_cmpeq_epi8(cur, utf8));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(first, _mm_cmpeq_epi8(prev, nl)));
+        for (; mask; mask &= mask - 1)
+        {
+            auto j = i + __builtin_ctz(mask);
+            if (check(j)) return j;
+        }
+    }
+#endif
+    for (; i < size; ++i)
+        if (data[i-1] == '\n' &&
+            (data[i] == SEP_SJIS[0] || data[i] == SEP_UTF8[0]) && check(i))
+            return i;
+    return size;
+}
+
+}
+
+TxtReader::TxtReader(std::istream& is)
+    : buf{std::istreambuf_iterator<char>{is}, {}}, data{buf} {}
+
+TxtReader::TxtReader(const boost::filesystem::path& fname)
+    : src{Source::FromFile(fname)}
+{
+    auto size = src->GetSize();
+    if (auto ptr = src->GetResidentData())
+        data = {ptr, size};
+    else
+    {
+        buf.resize(size);
+        src->Pread(0, &buf[0], size);
+        data = buf;
+    }
+}
+
+bool TxtReader::Next(StringView& body, StringView& rest)
+{
+    auto ptr = data.data();
+    size_t sep_len;
+    auto sep = FindSeparator(ptr, data.size(), pos, sep_len);
+    body = {ptr + pos, sep - pos};
+    if (sep == data.size())
+    {
+        pos = sep;
+        rest = {};
+        return false;
+    }
+
+    auto b = sep + sep_len;
+    auto nl = static_cast<const char*>(memchr(ptr + b, '\n', data.size() - b));
+    size_t e = nl ? nl - ptr : data.size();
+    pos = nl ? e + 1 : e;
+    sep_line = {ptr + sep, e - sep};
+    if (e > b && ptr[e-1] == '\r') --e;
+    rest = {ptr + b, e - b};
+    return true;
+}
+
+StringView TxtReader::Normalize(
+    StringView body, StringView nl, std::string& buf)
+{
+    if (!body.empty() && body.back() == '\n') body.remove_suffix(1);
+    if (!body.empty() && body.back() == '\r') body.remove_suffix(1);
+    auto ptr = body.data();
+    auto end = ptr + body.size();
+    if (nl == "\n" && (body.empty() || !memchr(ptr, '\r', body.size())))
+        return body;
+
+    buf.clear();
+    buf.reserve(body.size());
+    while (true)
+    {
+        auto e = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+        if (!e)
+        {
+            buf.append(ptr, end);
+            return buf;
+        }
+        auto line_end = (e > ptr && e[-1] == '\r') ? e - 1 : e;
+        buf.append(ptr, line_end).append(nl.data(), nl.size());
+        ptr = e + 1;
+    }
+}
+
+void TxtSerializable::ReadTxt(std::istream& is)
+{
+    TxtReader rd{is};
+    ReadTxt_(rd);
+}
+
+void TxtSerializable::ReadTxt(const boost::filesystem::path& fname)
+{
+    TxtReader rd{fname};
+    ReadTxt_(rd);
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef UUID_CA1AE291_A888_4250_A832_C3D5E9350880
+#define UUID_CA1AE291_A888_4250_A832_C3D5E9350880
+#pragma once
+
+#include "source.hpp"
+#include <iosfwd>
+#include <string>
+#include <boost/optional.hpp>
+
+namespace Neptools
+{
+
+// Splits strtool txt files at the separator lines: lines starting with 40
+// dashes, either Shift-JIS (81 5c) or UTF-8 (e2 80 95). Files are mapped
+// (other inputs read into memory once), separators are searched for with
+// SSE2 where available, and message bodies are handed out as views.
+class TxtReader
+{
+public:
+    // data must outlive the reader
+    explicit TxtReader(StringView data) noexcept : data{data} {}
+    // reads the rest of is
+    explicit TxtReader(std::istream& is);
+    explicit TxtReader(const boost::filesystem::path& fname);
+
+    TxtReader(const TxtReader&) = delete;
+    void operator=(const TxtReader&) = delete;
+
+    // Reads until the next separator line. body: the lines before it with
+    // their line ends, rest: the separator line after the dashes, without
+    // the line end. Returns false if there's no separator left, then body is
+    // the rest of the data.
+    bool Next(StringView& body, StringView& rest);
+    // the whole separator line found by the last successful Next, without
+    // the \n
+    StringView GetSeparatorLine() const noexcept { return sep_line; }
+
+    // body with its line ends (\r\n or \n) replaced by nl, except the last
+    // one, which is removed. Only copies into buf if something changes.
+    static StringView Normalize(StringView body, StringView nl,
+                                std::string& buf);
+
+private:
+    boost::optional<Source> src;
+    std::string buf;
+    StringView data, sep_line;
+    size_t pos = 0;
+};
+
+}
+#endif
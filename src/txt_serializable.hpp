@@ -2,22 +2,47 @@
 #define UUID_E17CE799_6569_40E4_A8FE_39F088AE30AB
 #pragma once
 
+#include "nonowning_string.hpp"
+#include <functional>
 #include <iosfwd>
+#include <boost/filesystem/path.hpp>
 
 namespace Neptools
 {
 
+class TxtReader;
+class TxtWriter;
+
 class TxtSerializable
 {
 public:
-    void WriteTxt(std::ostream& os) const { WriteTxt_(os); }
-    void WriteTxt(std::ostream&& os) const { WriteTxt_(os); }
-    void ReadTxt(std::istream& is) { ReadTxt_(is); }
-    void ReadTxt(std::istream&& is) { ReadTxt_(is); }
+    void WriteTxt(std::ostream& os) const;
+    void WriteTxt(std::ostream&& os) const { WriteTxt(os); }
+    // writes the file directly, without iostreams
+    void WriteTxt(const boost::filesystem::path& fname) const;
+    void WriteTxt(TxtWriter& wr) const { WriteTxt_(wr); }
+    // reads the rest of is
+    void ReadTxt(std::istream& is);
+    void ReadTxt(std::istream&& is) { ReadTxt(is); }
+    // maps the file
+    void ReadTxt(const boost::filesystem::path& fname);
+    void ReadTxt(TxtReader& rd) { ReadTxt_(rd); }
+
+    // The strings written to txt, in txt order, with \n line ends whatever
+    // the format uses.
+    using StringFun = std::function<void (StringView str)>;
+    void ForEachString(const StringFun& fun) const { ForEachString_(fun); }
+    // Like ForEachString, but fun can set out and return true to replace
+    // str. Returns the number of strings changed.
+    using ReplaceFun = std::function<bool (StringView str, StringView& out)>;
+    size_t ReplaceStrings(const ReplaceFun& fun)
+    { return ReplaceStrings_(fun); }
 
 private:
-    virtual void WriteTxt_(std::ostream& os) const = 0;
-    virtual void ReadTxt_(std::istream& is) = 0;
+    virtual void WriteTxt_(TxtWriter& wr) const = 0;
+    virtual void ReadTxt_(TxtReader& rd) = 0;
+    virtual void ForEachString_(const StringFun& fun) const = 0;
+    virtual size_t ReplaceStrings_(const ReplaceFun& fun) = 0;
 };
 
 }
@@ -0,0 +1,122 @@
+#include "txt_writer.hpp"
+#include "txt_serializable.hpp"
+#include "except.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <boost/exception/errinfo_file_name.hpp>
+
+#define NEPTOOLS_LOG_NAME "txt_writer"
+#include "logger_helper.hpp"
+
+namespace Neptools
+{
+
+TxtWriter::TxtWriter(std::ostream& os)
+    : os{&os}, buf{new char[BUF_SIZE]} {}
+
+TxtWriter::TxtWriter(const boost::filesystem::path& fname)
+    : io{AddInfo(
+            [&]() { return LowIo{fname.c_str(), true}; },
+            [&](auto& e) { e << boost::errinfo_file_name{fname.string()}; })},
+      buf{new char[BUF_SIZE]} {}
+
+TxtWriter::~TxtWriter()
+{
+    try { Flush(); }
+    catch (std::exception& e)
+    {
+        ERR << "~TxtWriter " << ExceptionToString() << std::endl;
+    }
+}
+
+void TxtWriter::Flush()
+{
+    if (put)
+    {
+        // clear first, so the destructor doesn't retry a failed write
+        auto len = put;
+        put = 0;
+        WriteOut(buf.get(), len);
+    }
+}
+
+void TxtWriter::WriteUint(uint64_t i)
+{
+    char tmp[20];
+    auto end = tmp + sizeof(tmp), ptr = end;
+    do *--ptr = '0' + i % 10; while (i /= 10);
+    Write({ptr, size_t(end - ptr)});
+}
+
+void TxtWriter::WriteLines(StringView str, StringView nl)
+{
+    NEPTOOLS_ASSERT(nl.size() == 1 || nl.size() == 2);
+    auto p = str.data(), end = p + str.size();
+    while (p != end)
+    {
+        // worst case: every input byte becomes two output bytes
+        if (BUF_SIZE - put < 4) Flush();
+        auto out = buf.get() + put;
+        auto chunk_end = p + std::min<size_t>(end - p, (BUF_SIZE - put) / 2);
+        while (p < chunk_end)
+        {
+            auto q = static_cast<const char*>(memchr(p, nl[0], chunk_end - p));
+            if (!q) q = chunk_end;
+            memcpy(out, p, q - p);
+            out += q - p;
+            p = q;
+            if (p == chunk_end) break;
+
+            if (nl.size() == 1 || (end - p >= 2 && p[1] == nl[1]))
+            {
+                *out++ = '\r';
+                *out++ = '\n';
+                p += nl.size();
+            }
+            else
+                *out++ = *p++;
+        }
+        put = out - buf.get();
+    }
+}
+
+void TxtWriter::Write_(StringView str)
+{
+    Flush();
+    if (str.size() >= BUF_SIZE)
+        WriteOut(str.data(), str.size());
+    else
+    {
+        memcpy(buf.get(), str.data(), str.size());
+        put = str.size();
+    }
+}
+
+void TxtWriter::WriteOut(const char* ptr, size_t len)
+{
+    if (os)
+    {
+        os->write(ptr, len);
+        if (!*os) NEPTOOLS_THROW(std::runtime_error{"TxtWriter: write failed"});
+    }
+    else
+        io.Write(ptr, len);
+}
+
+
+void TxtSerializable::WriteTxt(std::ostream& os) const
+{
+    TxtWriter wr{os};
+    WriteTxt_(wr);
+    wr.Flush();
+}
+
+void TxtSerializable::WriteTxt(const boost::filesystem::path& fname) const
+{
+    TxtWriter wr{fname};
+    WriteTxt_(wr);
+    wr.Flush();
+}
+
+}
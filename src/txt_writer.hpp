@@ -0,0 +1,57 @@
+#ifndef UUID_364A2859_C9CC_4E78_B711_5490ABC0E176
+#define UUID_364A2859_C9CC_4E78_B711_5490ABC0E176
+#pragma once
+
+#include "low_io.hpp"
+#include "nonowning_string.hpp"
+#include <iosfwd>
+#include <memory>
+#include <boost/filesystem/path.hpp>
+
+namespace Neptools
+{
+
+// Buffered output of strtool txt files. Everything is formatted directly into
+// one large buffer, which is written out a block at a time, either to a file
+// (without iostreams) or to an ostream.
+class TxtWriter
+{
+public:
+    static constexpr const size_t BUF_SIZE = 256*1024;
+
+    explicit TxtWriter(std::ostream& os);
+    explicit TxtWriter(const boost::filesystem::path& fname);
+    // flushes, but only logs errors. call Flush to see them.
+    ~TxtWriter();
+
+    TxtWriter(const TxtWriter&) = delete;
+    void operator=(const TxtWriter&) = delete;
+
+    void Write(StringView str)
+    {
+        if (str.size() <= BUF_SIZE - put)
+        {
+            memcpy(buf.get() + put, str.data(), str.size());
+            put += str.size();
+        }
+        else
+            Write_(str);
+    }
+    void WriteUint(uint64_t i);
+    // str with every nl replaced by \r\n
+    void WriteLines(StringView str, StringView nl);
+
+    void Flush();
+
+private:
+    void Write_(StringView str);
+    void WriteOut(const char* ptr, size_t len);
+
+    std::ostream* os = nullptr;
+    LowIo io;
+    std::unique_ptr<char[]> buf;
+    size_t put = 0;
+};
+
+}
+#endif
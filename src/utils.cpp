@@ -48,4 +48,21 @@ void DumpBytes(std::ostream& os, StringView data)
     os.flags(flags);
 }
 
+void DumpJsonString(std::ostream& os, StringView data)
+{
+    auto flags = os.flags();
+    os << std::hex << std::setfill('0') << '"';
+    for (size_t i = 0; i < data.length(); ++i)
+        if (data[i] == '"')
+            os << "\\\"";
+        else if (data[i] == '\\')
+            os << "\\\\";
+        else if (data[i] >= ' ' && data[i] <= '~')
+            os << data[i];
+        else
+            os << "\\u" << std::setw(4) << unsigned(data.uindex(i));
+    os << '"';
+    os.flags(flags);
+}
+
 }
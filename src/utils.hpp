@@ -43,7 +43,11 @@ constexpr size_t EmptySizeof = std::is_empty<T>::value ? 0 : sizeof(T);
 std::ofstream OpenOut(const boost::filesystem::path& pth);
 std::ifstream OpenIn(const boost::filesystem::path& pth);
 
+// Writes data as a quoted, C-like escaped string. Also valid as a graphviz
+// dot id or label.
 void DumpBytes(std::ostream& os, StringView data);
+// Writes data as a quoted JSON string, bytes outside ASCII become \u00XX
+void DumpJsonString(std::ostream& os, StringView data);
 
 #define NEPTOOLS_STATIC_ASSERT(...) static_assert(__VA_ARGS__, #__VA_ARGS__)
 
@@ -0,0 +1,507 @@
+#include "format/gbnl.hpp"
+#include "format/gbnl_query.hpp"
+#include "format/stats.hpp"
+#include "format/translation_memory.hpp"
+#include "sink.hpp"
+#include "test_helpers.hpp"
+#include <catch.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+using namespace Neptools;
+using namespace Neptools::Test;
+
+namespace
+{
+
+void Put(std::string& buf, size_t offs, uint32_t val)
+{
+    for (size_t i = 0; i < 4; ++i) buf[offs+i] = char(val >> (i*8));
+}
+
+size_t Align(size_t x) { return (x+15) & ~15; }
+
+// GBNL with rows messages of layout: uint32 id, uint8 + 3 bytes padding,
+// string ("msg <id%100>"), then cols uint32 (id*col)
+std::string GenGbnl(size_t rows, size_t cols)
+{
+    size_t descr_size = 12 + cols*4, count_types = 3 + cols;
+    std::string strs;
+    for (size_t i = 0; i < std::min<size_t>(rows, 100); ++i)
+    {
+        strs.append("msg ").append(std::to_string(i));
+        strs.push_back('\0');
+    }
+
+    auto offset_types = Align(rows * descr_size);
+    auto offset_msgs = Align(offset_types + count_types*4);
+    auto foot = Align(offset_msgs + strs.size());
+    std::string buf(foot + 0x40, '\0');
+
+    for (size_t i = 0; i < rows; ++i)
+    {
+        auto row = i * descr_size;
+        Put(buf, row, i);
+        buf[row+4] = char(i);
+        uint32_t str = 0;
+        for (size_t j = 0; j < i % 100; ++j)
+            str += 5 + std::to_string(j).size();
+        Put(buf, row+8, str);
+        for (size_t j = 0; j < cols; ++j)
+            Put(buf, row+12+j*4, i*j);
+    }
+
+    Put(buf, offset_types, 0);       // UINT32 @0
+    Put(buf, offset_types+4, 0x40001); // UINT8 @4
+    Put(buf, offset_types+8, 0x80005); // STRING @8
+    for (size_t j = 0; j < cols; ++j)
+        Put(buf, offset_types+12+j*4, (12+j*4) << 16);
+    memcpy(&buf[offset_msgs], strs.data(), strs.size());
+
+    memcpy(&buf[foot], "GBNL", 4);
+    Put(buf, foot+0x04, 1);
+    Put(buf, foot+0x08, 16);
+    Put(buf, foot+0x0c, 4);
+    Put(buf, foot+0x10, 1);            // flags
+    Put(buf, foot+0x18, rows);         // count_msgs
+    Put(buf, foot+0x1c, descr_size);   // msg_descr_size
+    Put(buf, foot+0x20, count_types);  // count_types
+    Put(buf, foot+0x24, offset_types);
+    Put(buf, foot+0x2c, offset_msgs);
+    return buf;
+}
+
+// GBNL with one message: uint32 id, 8 byte fix string "fix", string "off"
+std::string GenFixGbnl()
+{
+    std::string buf(0x70, '\0');
+    Put(buf, 0, 1);
+    memcpy(&buf[4], "fix", 3);
+    Put(buf, 12, 0);
+
+    Put(buf, 0x10, 0);       // UINT32 @0
+    Put(buf, 0x14, 0x40001); // UINT8 @4, followed by a gap: fix string
+    Put(buf, 0x18, 0xc0005); // STRING @12
+    memcpy(&buf[0x20], "off", 3);
+
+    memcpy(&buf[0x30], "GBNL", 4);
+    Put(buf, 0x34, 1);
+    Put(buf, 0x38, 16);
+    Put(buf, 0x3c, 4);
+    Put(buf, 0x40, 1);       // flags
+    Put(buf, 0x48, 1);       // count_msgs
+    Put(buf, 0x4c, 16);      // msg_descr_size
+    Put(buf, 0x50, 3);       // count_types
+    Put(buf, 0x54, 0x10);    // offset_types
+    Put(buf, 0x5c, 0x20);    // offset_msgs
+    return buf;
+}
+
+}
+
+TEST_CASE("gbnl table", "[Gbnl]")
+{
+    auto buf = GenGbnl(250, 4);
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    auto& msgs = gbnl->messages;
+    REQUIRE(msgs.size() == 250);
+    REQUIRE(msgs[0].GetSize() == 8); // + padding
+    CHECK(msgs.GetStride() % alignof(Gbnl::OffsetString) == 0);
+
+    auto ids = msgs.GetColumn<uint32_t>(0);
+    auto last = msgs.GetColumn<uint32_t>(7);
+    CHECK(ids.size() == 250);
+    CHECK(ids[123] == 123);
+    CHECK(last[123] == 123*3);
+    CHECK(msgs[123].Get<uint8_t>(1) == 123);
+    CHECK(msgs[123].Get<Gbnl::OffsetString>(3).Get() == "msg 23");
+    CHECK(Dump(*gbnl) == buf);
+
+    // id, uint8 and its padding merge into one copy, the string is separate
+    Gbnl::RowCodec codec{*msgs.GetRawType()};
+    CHECK(codec.GetRowSize() == 12 + 4*4);
+    REQUIRE(codec.GetStrings().size() == 1);
+    CHECK(codec.GetStrings()[0].file_offset == 8);
+    CHECK(codec.GetStrings()[0].item == 3);
+    std::string rows(3 * codec.GetRowSize(), '\0');
+    codec.Encode(msgs, 100, 3, &rows[0]);
+    CHECK(rows == buf.substr(100 * codec.GetRowSize(), rows.size()));
+
+    Gbnl::Table decoded{msgs.GetRawType(), 3};
+    codec.Decode(rows.data(), 3, decoded, 0);
+    CHECK(decoded[1].Get<uint32_t>(0) == 101);
+    CHECK(decoded[1].Get<uint8_t>(1) == 101);
+    CHECK(decoded[2].Get<uint32_t>(7) == 102*3);
+
+    // memory sources stay alive, no need to copy the strings
+    CHECK(msgs[5].Get<Gbnl::OffsetString>(3).IsView());
+
+    auto copy = msgs;
+    msgs[5].Get<Gbnl::OffsetString>(3).Set("changed");
+    CHECK(!msgs[5].Get<Gbnl::OffsetString>(3).IsView());
+    CHECK(copy[5].Get<Gbnl::OffsetString>(3).IsView());
+    msgs.GetColumn<uint32_t>(4)[5] = 77;
+    CHECK(copy[5].Get<Gbnl::OffsetString>(3).Get() == "msg 5");
+    CHECK(copy[5].Get<uint32_t>(4) == 0);
+
+    gbnl->RecalcSize();
+    auto changed = Dump(*gbnl);
+    CHECK(changed.find("changed") != std::string::npos);
+
+    gbnl->messages = std::move(copy);
+    gbnl->RecalcSize();
+    CHECK(Dump(*gbnl) == buf);
+}
+
+TEST_CASE("gbnl layout interning", "[Gbnl]")
+{
+    auto a = MakeSmart<Gbnl>(ToSource(GenGbnl(10, 2)));
+    auto count = Gbnl::Layout::GetInternedCount();
+    auto b = MakeSmart<Gbnl>(ToSource(GenGbnl(20, 2)));
+    CHECK(a->messages.GetRawType() == b->messages.GetRawType());
+    {
+        auto c = MakeSmart<Gbnl>(ToSource(GenGbnl(20, 3)));
+        CHECK(a->messages.GetRawType() != c->messages.GetRawType());
+        CHECK(Gbnl::Layout::GetInternedCount() == count + 1);
+    }
+    CHECK(Gbnl::Layout::GetInternedCount() == count);
+
+    // GetId special cases are decided once per layout
+    CHECK(a->messages[0].GetSize() == 6);
+    Gbnl::Struct::TypeBuilder bld;
+    bld.Add<uint32_t>();
+    for (size_t i = 0; i < 7; ++i) bld.Add<uint16_t>();
+    bld.Add<Gbnl::OffsetString>();
+    Gbnl::Layout rb{bld.Build()}; // Re;Birth scripts
+    CHECK(rb.id_item == 8);
+    CHECK(!rb.gstl_ids);
+    CHECK(rb.codec.GetRowSize() == 4 + 7*2 + 4);
+}
+
+namespace
+{
+// split txt into its entries (without the final EOF one) in reverse order
+std::string ReverseTxt(const std::string& txt)
+{
+    std::vector<std::string> entries;
+    auto sep = txt.substr(0, txt.find_first_of("0123456789"));
+    for (size_t p = 0, n; (n = txt.find(sep, p+1)) != std::string::npos;
+         p = n)
+        entries.push_back(txt.substr(p, n - p));
+    return std::accumulate(entries.rbegin(), entries.rend(), std::string{}) +
+        sep + "EOF\r\n";
+}
+}
+
+TEST_CASE("gbnl txt import", "[Gbnl]")
+{
+    auto buf = GenGbnl(250, 1);
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    std::stringstream ss;
+    gbnl->WriteTxt(ss);
+    auto txt = ss.str();
+
+    // ids are item*10000 + message
+    auto pos = txt.find("10007\r\nmsg 7\r\n");
+    REQUIRE(pos != std::string::npos);
+    txt.replace(pos + 7, 5, "foo\r\nbar");
+    gbnl->ReadTxt(std::istringstream{ReverseTxt(txt)});
+
+    auto strs = gbnl->messages.GetColumn<Gbnl::OffsetString>(3);
+    CHECK(strs[7].Get() == "foo\nbar");
+    CHECK(strs[6].Get() == "msg 6");
+    CHECK(strs[107].Get() == "msg 7");
+
+    auto bad = txt.substr(0, txt.find("10001")) + "99\r\nx\r\n";
+    CHECK_THROWS(gbnl->ReadTxt(std::istringstream{bad}));
+}
+
+TEST_CASE("gbnl csv", "[Gbnl]")
+{
+    auto buf = GenGbnl(120, 2);
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    std::stringstream ss;
+    gbnl->WriteCsv(ss);
+    auto csv = ss.str();
+    CHECK(csv.compare(0, 48, "uint32,uint8,string,uint32,uint32\n"
+                      "0,0,msg 0,0,0\n") == 0);
+    auto pos = csv.find("\n7,7,msg 7,0,7\n");
+    REQUIRE(pos != std::string::npos);
+
+    // round trip
+    gbnl->ReadCsv(std::istringstream{csv});
+    CHECK(Dump(*gbnl) == buf);
+
+    auto changed = csv;
+    changed.replace(pos+1, 13, "7,255,\"a,\"\"b\"\"\nc\",0,4294967295");
+    changed.append("1000,1,\"\",2,3\r\n");
+    gbnl->ReadCsv(std::istringstream{changed});
+    auto& msgs = gbnl->messages;
+    REQUIRE(msgs.size() == 121);
+    CHECK(msgs[7].Get<uint8_t>(1) == 255);
+    CHECK(msgs[7].Get<Gbnl::OffsetString>(3).Get() == "a,\"b\"\nc");
+    CHECK(msgs[7].Get<uint32_t>(5) == 4294967295);
+    CHECK(msgs[120].Get<uint32_t>(0) == 1000);
+    CHECK(msgs[120].Get<Gbnl::OffsetString>(3).Get() == "");
+    CHECK(msgs[120].Get<Gbnl::OffsetString>(3).offset != uint32_t(-1));
+
+    // empty field: null string
+    changed.replace(changed.find("msg 8"), 5, "");
+    gbnl->ReadCsv(std::istringstream{changed});
+    CHECK(msgs[8].Get<Gbnl::OffsetString>(3).offset == uint32_t(-1));
+    std::stringstream ss2;
+    gbnl->WriteCsv(ss2);
+    CHECK(ss2.str() == changed.substr(0, changed.size()-2) + "\n");
+
+    // errors leave the messages alone
+    CHECK_THROWS(gbnl->ReadCsv(std::istringstream{"uint32\n"}));
+    CHECK_THROWS(gbnl->ReadCsv(std::istringstream{csv + "1,256,x,0,0\n"}));
+    CHECK_THROWS(gbnl->ReadCsv(std::istringstream{csv + "1,2,x,0\n"}));
+    CHECK_THROWS(gbnl->ReadCsv(std::istringstream{csv + "1,2,\"x,0,0\n"}));
+    CHECK(msgs.size() == 121);
+
+    // tab separated
+    std::stringstream tsv;
+    gbnl->WriteCsv(tsv, '\t');
+    CHECK(tsv.str().compare(0, 14, "uint32\tuint8\ts") == 0);
+    gbnl->messages.resize(3);
+    gbnl->ReadCsv(tsv, '\t');
+    CHECK(msgs.size() == 121);
+    CHECK(msgs[7].Get<Gbnl::OffsetString>(3).Get() == "a,\"b\"\nc");
+}
+
+TEST_CASE("gbnl query", "[Gbnl]")
+{
+    auto buf = GenGbnl(250, 2);
+    std::string out;
+    CHECK(GbnlQuery{"cols=0,2 where 0>100 and 0<=103"}.Run(
+              ToSource(buf), "x", out));
+    CHECK(out == "x\t101\t101\tmsg 1\n"
+                 "x\t102\t102\tmsg 2\n"
+                 "x\t103\t103\tmsg 3\n");
+
+    out.clear();
+    CHECK(GbnlQuery{"where 2 = \"msg 7\" and 4 != 7"}.Run(
+              ToSource(buf), "y", out));
+    CHECK(out == "y\t107\t107\t107\tmsg 7\t0\t107\n"
+                 "y\t207\t207\t207\tmsg 7\t0\t207\n");
+
+    // every column must exist
+    out.clear();
+    CHECK(!GbnlQuery{"cols=0 where 5=1"}.Run(ToSource(buf), "z", out));
+    CHECK(out.empty());
+
+    CHECK_THROWS(GbnlQuery{"cols="});
+    CHECK_THROWS(GbnlQuery{"where 0 ~ 1"});
+    CHECK_THROWS(GbnlQuery{"where 0 = \"x"});
+    CHECK_THROWS(GbnlQuery{"cols=0 foo"});
+}
+
+TEST_CASE("gbnl query files", "[Gbnl]")
+{
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    GbnlQuery query{"cols=2 where 0<3"};
+    std::vector<fs::path> files;
+    std::string exp;
+    for (size_t i = 0; i < 20; ++i)
+    {
+        auto buf = GenGbnl(10 + i, i % 3);
+        files.push_back(dir / (std::to_string(i) + ".gbin"));
+        std::ofstream{files.back().string(), std::ios::binary} << buf;
+        REQUIRE(query.Run(ToSource(buf), files.back().string(), exp));
+    }
+
+    std::stringstream ss;
+    CHECK(query.Run(files, ss, 4));
+    CHECK(ss.str() == exp);
+
+    // a failed file doesn't stop the others
+    files.insert(files.begin() + 5, dir / "missing.gbin");
+    std::stringstream ss2;
+    CHECK(!query.Run(files, ss2, 3));
+    CHECK(ss2.str() == exp);
+
+    fs::remove_all(dir);
+}
+
+TEST_CASE("gbnl translation memory", "[Gbnl]")
+{
+    auto gbnl = MakeSmart<Gbnl>(ToSource(GenGbnl(300, 1)));
+    std::vector<std::string> strs;
+    gbnl->ForEachString([&](StringView s) { strs.push_back(s.to_string()); });
+    REQUIRE(strs.size() == 300);
+    CHECK(strs[105] == "msg 5");
+
+    TranslationMemory tm;
+    tm.Add(*gbnl);
+    REQUIRE(tm.GetEntries().size() == 100);
+    tm.ReplaceStrings([](StringView str, StringView& out)
+    {
+        if (!(str == "msg 5")) return false;
+        out = "first\nsecond";
+        return true;
+    });
+
+    TranslationMemory::Table tbl{ToSource(Dump(tm))};
+    CHECK(tbl.Apply(*gbnl) == 3);
+    CHECK(gbnl->messages[205].Get<Gbnl::OffsetString>(3).Get() ==
+          "first\nsecond");
+    CHECK(gbnl->messages[206].Get<Gbnl::OffsetString>(3).Get() == "msg 6");
+    CHECK(tbl.Apply(*gbnl) == 0);
+
+    auto reparsed = MakeSmart<Gbnl>(ToSource(Dump(*gbnl)));
+    CHECK(reparsed->messages[5].Get<Gbnl::OffsetString>(3).Get() ==
+          "first\nsecond");
+}
+
+TEST_CASE("gbnl replace strings", "[Gbnl]")
+{
+    auto gbnl = MakeSmart<Gbnl>(ToSource(GenFixGbnl()));
+    auto strs = [&]()
+    {
+        std::vector<std::string> ret;
+        gbnl->ForEachString([&](StringView s) { ret.push_back(s.to_string()); });
+        return ret;
+    };
+    CHECK(strs() == (std::vector<std::string>{"fix", "off"}));
+
+    auto replace = [&](StringView from, StringView to)
+    {
+        return gbnl->ReplaceStrings([&](StringView s, StringView& out)
+        {
+            if (!(s == from)) return false;
+            out = to;
+            return true;
+        });
+    };
+    // doesn't fit with the terminator, left alone instead of truncated
+    CHECK(replace("fix", "12345678") == 0);
+    CHECK(replace("fix", "1234567") == 1);
+    CHECK(replace("off", "longer string") == 1);
+    CHECK(strs() == (std::vector<std::string>{"1234567", "longer string"}));
+}
+
+TEST_CASE("gbnl csv fix string", "[Gbnl]")
+{
+    // uint32 id, 8 byte fix string filled without a terminator, uint32
+    std::string buf(0x60, '\0');
+    Put(buf, 0, 1);
+    memcpy(&buf[4], "fixfixfi", 8);
+    memcpy(&buf[12], "AAAA", 4);
+
+    Put(buf, 0x10, 0);       // UINT32 @0
+    Put(buf, 0x14, 0x40001); // UINT8 @4, followed by a gap: fix string
+    Put(buf, 0x18, 0xc0000); // UINT32 @12
+
+    memcpy(&buf[0x20], "GBNL", 4);
+    Put(buf, 0x24, 1);
+    Put(buf, 0x28, 16);
+    Put(buf, 0x2c, 4);
+    Put(buf, 0x30, 1);       // flags
+    Put(buf, 0x38, 1);       // count_msgs
+    Put(buf, 0x3c, 16);      // msg_descr_size
+    Put(buf, 0x40, 3);       // count_types
+    Put(buf, 0x44, 0x10);    // offset_types
+    Put(buf, 0x4c, 0x20);    // offset_msgs
+
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    std::stringstream ss;
+    gbnl->WriteCsv(ss);
+    auto csv = ss.str();
+    CHECK(csv.substr(csv.find('\n') + 1) == "1,fixfixfi,1094795585\n");
+}
+
+TEST_CASE("gbnl csv benchmark", "[.][benchmark][Gbnl]")
+{
+    static constexpr size_t ROWS = 5000, COLS = 100;
+
+    auto buf = GenGbnl(ROWS, COLS);
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    auto t0 = Clock::now();
+    std::stringstream ss;
+    gbnl->WriteCsv(ss);
+    auto t1 = Clock::now();
+    gbnl->ReadCsv(ss);
+    auto t2 = Clock::now();
+    CHECK(Dump(*gbnl) == buf);
+    WARN(ROWS << "x" << COLS << " cells: export " << Ms(t1-t0)
+         << " ms, import " << Ms(t2-t1) << " ms");
+}
+
+TEST_CASE("gbnl txt import benchmark", "[.][benchmark][Gbnl]")
+{
+    static constexpr size_t ROWS = 30000;
+
+    auto gbnl = MakeSmart<Gbnl>(ToSource(GenGbnl(ROWS, 1)));
+    std::stringstream ss;
+    gbnl->WriteTxt(ss);
+    auto txt = ReverseTxt(ss.str());
+
+    auto t0 = Clock::now();
+    gbnl->ReadTxt(std::istringstream{txt});
+    auto t1 = Clock::now();
+    CHECK(gbnl->messages[ROWS-1].Get<Gbnl::OffsetString>(3).Get() ==
+          "msg " + std::to_string((ROWS-1) % 100));
+    WARN(ROWS << " reversed lines: import " << Ms(t1-t0) << " ms");
+}
+
+TEST_CASE("gbnl benchmark", "[.][benchmark][Gbnl]")
+{
+    // as wide as RB3's stdungeon.gbin
+    static constexpr size_t ROWS = 5000, COLS = (7576 - 12) / 4;
+
+    auto buf = GenGbnl(ROWS, COLS);
+    auto t0 = Clock::now();
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    auto t1 = Clock::now();
+    auto out = Dump(*gbnl);
+    auto t2 = Clock::now();
+    CHECK(out == buf);
+
+    // every string unique, like in a translated gstr
+    auto strs = gbnl->messages.GetColumn<Gbnl::OffsetString>(3);
+    for (size_t i = 0; i < ROWS; ++i)
+        strs[i].Set("translated message " + std::to_string(i));
+    auto t3 = Clock::now();
+    gbnl->RecalcSize();
+    auto t4 = Clock::now();
+
+    ContextStats stats;
+    stats.Add(*gbnl);
+    WARN(ROWS << " rows, " << buf.size() << " bytes: parse " << Ms(t1-t0)
+         << " ms, dump " << Ms(t2-t1) << " ms, recalc " << Ms(t4-t3)
+         << " ms, " << stats.message_bytes << " bytes in rows");
+}
+
+TEST_CASE("gbnl dump benchmark", "[.][benchmark][Gbnl]")
+{
+    // RB3's stdungeon.gbin is the largest known
+    static constexpr size_t ROWS = 5000, COLS = (7576 - 12) / 4, N = 10;
+
+    auto buf = GenGbnl(ROWS, COLS);
+    auto gbnl = MakeSmart<Gbnl>(ToSource(buf));
+    std::string out;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < N; ++i) out = Dump(*gbnl);
+    auto t1 = Clock::now();
+    CHECK(out == buf);
+
+    // too large for the file sinks' windows, goes through a temporary buffer
+    namespace fs = boost::filesystem;
+    auto tmp = fs::temp_directory_path() / fs::unique_path();
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto sink = Sink::ToFile(tmp, buf.size());
+        gbnl->Dump(*sink);
+    }
+    auto t2 = Clock::now();
+    fs::remove(tmp);
+    WARN(buf.size() << " bytes: memory " << Us(t1-t0)/N << " us, file "
+         << Us(t2-t1)/N << " us per dump");
+}
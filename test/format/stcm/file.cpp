@@ -0,0 +1,329 @@
+#include "format/stcm/file.hpp"
+#include "format/stcm/instruction.hpp"
+#include "format/stcm/xref.hpp"
+#include "format/parse_cache.hpp"
+#include "format/raw_item.hpp"
+#include "format/stats.hpp"
+#include "sink.hpp"
+#include "utils.hpp"
+#include "../test_helpers.hpp"
+#include <catch.hpp>
+#include <boost/endian/conversion.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace Neptools;
+using namespace Neptools::Test;
+
+namespace
+{
+
+// stores val as a little endian uint32_t at buf[offs]
+void Put(std::string& buf, size_t offs, uint32_t val)
+{
+    boost::endian::native_to_little_inplace(val);
+    memcpy(&buf[offs], &val, 4);
+}
+
+// header + one code export + empty collection link, followed by count
+// instructions, each with the same number of READ_STACK params, only the last
+// one terminating
+std::string GenStcm(size_t count, size_t params = 0)
+{
+    auto isize = 0x10 + params*0xc;
+    std::string buf(0x98 + count*isize, '\0');
+    auto put = [&](size_t offs, uint32_t val) { Put(buf, offs, val); };
+
+    memcpy(&buf[0], "STCM2L", 6);
+    put(0x20, 0x30); // export offset
+    put(0x24, 1);    // export count
+    put(0x2c, 0x58); // collection link header
+
+    put(0x30, 0);    // CODE
+    memcpy(&buf[0x34], "main", 4);
+    put(0x54, 0x98);
+
+    put(0x58+4, buf.size()); // empty collection link at eof
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto offs = 0x98 + i*isize;
+        put(offs+4, i == count-1 ? 0 : 1); // opcode 0 doesn't return
+        put(offs+8, params);
+        put(offs+12, isize);
+        for (size_t j = 0; j < params; ++j)
+        {
+            auto poffs = offs + 0x10 + j*0xc;
+            put(poffs, 0xffffff00 + j);
+            put(poffs+4, 0x40000000);
+            put(poffs+8, 0x40000000);
+        }
+    }
+    return buf;
+}
+
+// appends a DataItem holding a GBNL with one (id, str) message, returns its
+// offset. str must fit into 16 bytes
+size_t AppendGbnl(std::string& buf, uint32_t id, const char* str)
+{
+    auto data = buf.size();
+    buf.resize(data + 0x10 + 0x70);
+    auto put = [&](size_t offs, uint32_t val) { Put(buf, offs, val); };
+
+    put(0x58+4, buf.size()); // move collection link to the new eof
+    put(data+12, 0x70);      // DataItem header length
+    auto gbnl = data + 0x10;
+    put(gbnl, id);
+    put(gbnl+4, 0);          // string offset
+    put(gbnl+0x10, 0);       // UINT32 @0
+    put(gbnl+0x14, 0x40005); // STRING @4
+    memcpy(&buf[gbnl+0x20], str, strlen(str));
+
+    auto foot = gbnl + 0x30;
+    memcpy(&buf[foot], "GBNL", 4);
+    put(foot+0x04, 1);
+    put(foot+0x08, 16);
+    put(foot+0x0c, 4);
+    put(foot+0x10, 1);       // flags
+    put(foot+0x18, 1);       // count_msgs
+    put(foot+0x1c, 8);       // msg_descr_size
+    put(foot+0x20, 2);       // count_types
+    put(foot+0x24, 0x10);    // offset_types
+    put(foot+0x2c, 0x20);    // offset_msgs
+    return data;
+}
+
+// make the param of instruction i in GenStcm(n, 1) a MEM_OFFSET to offs
+void RefData(std::string& buf, size_t i, size_t offs)
+{
+    auto poffs = 0x98 + i*0x1c + 0x10;
+    Put(buf, poffs, offs);
+    Put(buf, poffs+4, 0x40000000);
+    Put(buf, poffs+8, 0x40000000);
+}
+
+// GenStcm(2, 1) with the first instruction referencing a GBNL
+std::string GenStcmWithGbnl()
+{
+    auto buf = GenStcm(2, 1);
+    RefData(buf, 0, AppendGbnl(buf, 7, "GBNL in strings"));
+    return buf;
+}
+
+}
+
+TEST_CASE("parse long stcm", "[Stcm::File]")
+{
+    static constexpr size_t COUNT = 1000000;
+    auto buf = GenStcm(COUNT);
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+
+    size_t instrs = 0;
+    ForEachItem<Stcm::InstructionItem>(
+        static_cast<Item&>(*file), [&](auto&) { ++instrs; });
+    CHECK(instrs == COUNT);
+
+    file->Fixup();
+    REQUIRE(file->GetSize() == buf.size());
+    CHECK(Dump(*file) == buf);
+}
+
+TEST_CASE("stcm gbnl scan", "[Stcm::File]")
+{
+    auto buf = GenStcmWithGbnl();
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+    REQUIRE(file->FindGbnl().size() == 1);
+    std::stringstream full, scan;
+    file->WriteTxt(full);
+
+    auto gbnls = Stcm::File::ScanGbnl(ToSource(buf));
+    REQUIRE(gbnls.size() == 1);
+    gbnls[0]->WriteTxt(scan);
+    CHECK(full.str() == scan.str());
+    CHECK(full.str().find("GBNL in strings") != std::string::npos);
+
+    // the data item no longer ends in the GBNL
+    Put(buf, buf.size() - 0x80 + 12, 0x60);
+    CHECK(Stcm::File::ScanGbnl(ToSource(buf)).empty());
+    CHECK(Stcm::File::ScanGbnl(ToSource(GenStcm(10))).empty());
+}
+
+TEST_CASE("stcm gbnl scan matches the full parse", "[Stcm::File]")
+{
+    // referenced in reverse file order, with an unreferenced one between them
+    auto buf = GenStcm(3, 1);
+    auto first = AppendGbnl(buf, 1, "first");
+    AppendGbnl(buf, 2, "decoy");
+    auto last = AppendGbnl(buf, 3, "last");
+    RefData(buf, 0, last);
+    RefData(buf, 2, first);
+
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+    auto full = file->FindGbnl();
+    auto scan = Stcm::File::ScanGbnl(ToSource(buf));
+    REQUIRE(full.size() == 2);
+    REQUIRE(scan.size() == 2);
+    for (size_t i = 0; i < 2; ++i)
+    {
+        std::stringstream full_txt, scan_txt;
+        full[i]->WriteTxt(full_txt);
+        scan[i]->WriteTxt(scan_txt);
+        CHECK(full_txt.str() == scan_txt.str());
+    }
+    std::stringstream txt;
+    file->WriteTxt(txt);
+    CHECK(txt.str().find("first") < txt.str().find("last"));
+    CHECK(txt.str().find("decoy") == std::string::npos);
+
+    // a reference into a GBNL: the scan gives up
+    RefData(buf, 1, last + 0x20);
+    CHECK(Stcm::File::ScanGbnl(ToSource(buf)).empty());
+}
+
+TEST_CASE("stcm gbnl registry", "[Stcm::File]")
+{
+    auto buf = GenStcmWithGbnl();
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+    auto gbnls = file->FindGbnl();
+    REQUIRE(gbnls.size() == 1);
+
+    // replaced items are unregistered, the new ones registered
+    auto data = gbnls[0]->GetParent();
+    auto raw = file->Create<RawItem>(
+        Source{ToSource(buf), gbnls[0]->GetPosition(), gbnls[0]->GetSize()});
+    gbnls[0]->Replace(raw);
+    CHECK(file->FindGbnl().empty());
+    raw->Replace(gbnls[0]);
+    CHECK(file->FindGbnl().size() == 1);
+
+    // so are whole subtrees
+    SmartPtr<Item> data_ptr{data};
+    auto raw_data = file->Create<RawItem>(
+        Source{ToSource(buf), data->GetPosition(), data->GetSize()});
+    data->Replace(raw_data);
+    CHECK(file->FindGbnl().empty());
+    raw_data->Replace(MakeNotNull(data_ptr));
+    CHECK(file->FindGbnl().size() == 1);
+}
+
+TEST_CASE("stcm xref index", "[Stcm::File]")
+{
+    // main: 0 calls 50 twice (10 and 20), 50 calls 60, 60 calls 50
+    auto buf = GenStcm(100);
+    auto call = [&](size_t from, size_t to)
+    {
+        Put(buf, 0x98 + from*0x10, 1);
+        Put(buf, 0x98 + from*0x10 + 4, 0x98 + to*0x10);
+    };
+    call(10, 50); call(20, 50); call(55, 60); call(65, 50);
+    Put(buf, 0x98 + 49*0x10 + 4, 0); // 50 and 60 are only reached by calls
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+    Stcm::XrefIndex xref{*file};
+
+    auto& target = file->GetLabel("loc_000003b8"); // instruction 50
+    auto refs = xref.GetRefs(target);
+    REQUIRE(refs.size() == 3);
+    for (const auto& r : refs)
+        CHECK(r.type == Stcm::XrefIndex::RefType::CALL);
+    CHECK(refs[0].item->GetPosition() == 0x98 + 10*0x10);
+    CHECK(refs[2].item->GetPosition() == 0x98 + 65*0x10);
+
+    auto main_refs = xref.GetRefs(file->GetLabel("main"));
+    REQUIRE(main_refs.size() == 1);
+    CHECK(main_refs[0].type == Stcm::XrefIndex::RefType::EXPORT);
+
+    auto graph = xref.GetCallGraph();
+    REQUIRE(graph.nodes.size() == 3);
+    CHECK(graph.nodes[0]->name == "main");
+    using E = std::pair<uint32_t, uint32_t>;
+    CHECK(graph.edges == (std::vector<E>{{0, 1}, {1, 2}, {2, 1}}));
+
+    std::stringstream json;
+    Stcm::XrefIndex::WriteJson(json, graph);
+    CHECK(json.str().find("\"edges\":[[0,1],[1,2],[2,1]]") != std::string::npos);
+}
+
+TEST_CASE("stcm xref escapes names", "[Stcm::File]")
+{
+    auto buf = GenStcm(2);
+    memcpy(&buf[0x34], "a\"b\\\n\x81", 6); // hostile export name
+    auto file = MakeSmart<Stcm::File>(ToSource(buf));
+    auto graph = Stcm::XrefIndex{*file}.GetCallGraph();
+    REQUIRE(graph.nodes.size() == 1);
+    CHECK(graph.nodes[0]->name == "a_b___");
+
+    std::stringstream dot, json;
+    Stcm::XrefIndex::WriteDot(dot, graph);
+    CHECK(dot.str() == "digraph stcm {\n    \"a_b___\";\n}\n");
+    Stcm::XrefIndex::WriteJson(json, graph);
+    CHECK(json.str() ==
+          "{\"nodes\":[{\"name\":\"a_b___\",\"position\":152}],\"edges\":[]}\n");
+
+    // names the filter would let through are escaped
+    std::stringstream str;
+    DumpJsonString(str, "a\"b\\\n\x81");
+    CHECK(str.str() == "\"a\\\"b\\\\\\u000a\\u0081\"");
+}
+
+TEST_CASE("stcm instruction benchmark", "[.][benchmark][Stcm::File]")
+{
+    static constexpr size_t COUNT = 1000000;
+    for (size_t params : {0, 2, 4, 6})
+    {
+        auto buf = GenStcm(COUNT, params);
+        auto t0 = Clock::now();
+        auto file = MakeSmart<Stcm::File>(ToSource(buf));
+        auto t1 = Clock::now();
+
+        file->Fixup();
+        REQUIRE(file->GetSize() == buf.size());
+        auto t2 = Clock::now();
+        auto out = Dump(*file);
+        auto t3 = Clock::now();
+        CHECK(out == buf);
+
+        ContextStats stats;
+        stats.Add(*file);
+        WARN(params << " params: parse " << Ms(t1-t0) << " ms, dump "
+             << Ms(t3-t2) << " ms, sizeof(InstructionItem) "
+             << sizeof(Stcm::InstructionItem) << ", param heap bytes "
+             << stats.vector_bytes);
+    }
+}
+
+TEST_CASE("stcm parse cache", "[Stcm::File]")
+{
+    auto buf = GenStcm(100);
+    // instruction 10 calls instruction 50
+    Put(buf, 0x98 + 10*0x10, 1);
+    Put(buf, 0x98 + 10*0x10 + 4, 0x98 + 50*0x10);
+
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    ParseCache::SetDirectory(dir);
+    std::stringstream cold, warm;
+    cold << *MakeSmart<Stcm::File>(ToSource(buf));
+
+    std::vector<fs::path> files{fs::directory_iterator{dir}, {}};
+    REQUIRE(files.size() == 1);
+    // trailing garbage is ignored when reading, but a rewritten cache file
+    // wouldn't have it
+    auto size = fs::file_size(files[0]);
+    std::ofstream{files[0].string(), std::ios::app} << '!';
+
+    warm << *MakeSmart<Stcm::File>(ToSource(buf));
+    CHECK(fs::file_size(files[0]) == size + 1);
+    CHECK(cold.str() == warm.str());
+
+    // invalid cache: parse normally, then overwrite it
+    std::ofstream{files[0].string(), std::ios::binary} << "garbage";
+    std::stringstream reparsed;
+    reparsed << *MakeSmart<Stcm::File>(ToSource(buf));
+    CHECK(cold.str() == reparsed.str());
+    CHECK(fs::file_size(files[0]) == size);
+
+    ParseCache::SetDirectory({});
+    fs::remove_all(dir);
+}
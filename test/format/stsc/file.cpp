@@ -0,0 +1,283 @@
+#include "format/stsc/cfg.hpp"
+#include "format/stsc/file.hpp"
+#include "format/stsc/instruction.hpp"
+#include "format/stats.hpp"
+#include "sink.hpp"
+#include "../test_helpers.hpp"
+#include <catch.hpp>
+#include <cstring>
+#include <sstream>
+
+using namespace Neptools;
+using namespace Neptools::Test;
+
+namespace
+{
+
+// count two byte instructions (0x0c: uint8_t), then a terminating 0x07
+std::string GenStsc(size_t count)
+{
+    std::string buf = "STSC\x0c";
+    buf.append(7, '\0');
+    for (size_t i = 0; i < count; ++i)
+        buf.append({'\x0c', char(i)});
+    buf.push_back('\x07');
+    return buf;
+}
+
+// count 0x0e instructions referencing two line strings, then a terminating
+// 0x07 and the strings
+std::string GenStscStrings(size_t count)
+{
+    std::string buf = "STSC\x0c";
+    buf.append(7, '\0');
+    std::string strs;
+    auto str_base = buf.size() + count*5 + 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t offs = str_base + strs.size();
+        buf.push_back('\x0e');
+        for (size_t j = 0; j < 4; ++j) buf.push_back(char(offs >> (j*8)));
+        strs.append("line ").append(std::to_string(i)).append("\\nsecond line");
+        strs.push_back('\0');
+    }
+    buf.push_back('\x07');
+    return buf + strs;
+}
+
+}
+
+TEST_CASE("parse long stsc", "[Stsc::File]")
+{
+    static constexpr size_t COUNT = 1000000;
+    auto buf = GenStsc(COUNT);
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+
+    size_t instrs = 0;
+    ForEachItem<Stsc::InstructionBase>(
+        static_cast<Item&>(*file), [&](auto&) { ++instrs; });
+    CHECK(instrs == COUNT + 1);
+
+    file->Fixup();
+    REQUIRE(file->GetSize() == buf.size());
+    CHECK(Dump(*file) == buf);
+}
+
+TEST_CASE("stsc flavor", "[Stsc::File]")
+{
+    NEPTOOLS_STATIC_ASSERT(std::is_same<
+        Stsc::InstructionItem<Stsc::Flavor::NOIRE, 0x0e>,
+        Stsc::SimpleInstruction<false, std::string>>::value);
+
+    std::string buf{"STSC\x0c\0\0\0\0\0\0\0" "\x0e\x12\0\0\0\x07" "foo\0", 22};
+    auto file = MakeSmart<Stsc::File>(ToSource(buf), Stsc::Flavor::NOIRE);
+    CHECK(file->GetFlavor() == Stsc::Flavor::NOIRE);
+    auto& instr = AssertedCast<Stsc::InstructionBase>(
+        *++file->GetChildren().begin());
+    CHECK(instr.opcode == 0x0e);
+    CHECK(dynamic_cast<Stsc::SimpleInstruction<false, std::string>*>(&instr));
+}
+
+TEST_CASE("stsc string import", "[Stsc::File]")
+{
+    // 0x0e str; 0x07; "foo"
+    std::string buf{"STSC\x0c\0\0\0\0\0\0\0" "\x0e\x12\0\0\0\x07" "foo\0", 22};
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+    file->Fixup();
+
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    auto txt = ss.str();
+    CHECK(txt.substr(0, 5) == "foo\r\n");
+
+    file->ReadTxt(std::istringstream{"barbaz\r\n" + txt.substr(5)});
+    file->Fixup();
+    REQUIRE(file->GetSize() == buf.size() + 3);
+    CHECK(Dump(*file) == std::string{
+            "STSC\x0c\0\0\0\0\0\0\0" "\x0e\x12\0\0\0\x07" "barbaz\0", 25});
+}
+
+TEST_CASE("stsc txt round trip", "[Stsc::File]")
+{
+    auto buf = GenStscStrings(100);
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    auto txt = ss.str();
+    CHECK(txt.substr(0, 23) == "line 0\r\nsecond line\r\n\x81\x5c");
+
+    file->ReadTxt(std::istringstream{txt});
+    std::stringstream ss2;
+    file->WriteTxt(ss2);
+    CHECK(ss2.str() == txt);
+
+    file->Fixup();
+    REQUIRE(file->GetSize() == buf.size());
+    CHECK(Dump(*file) == buf);
+
+    auto sep = txt.find('\n', 22) + 1;
+    CHECK_THROWS(file->ReadTxt(std::istringstream{txt.substr(sep)}));
+    CHECK_THROWS(file->ReadTxt(std::istringstream{txt.substr(0, sep) + txt}));
+}
+
+TEST_CASE("stsc txt separator lines", "[Stsc::File]")
+{
+    auto file = MakeSmart<Stsc::File>(ToSource(GenStscStrings(2)));
+    std::string sjis, utf8;
+    for (int i = 0; i < 40; ++i)
+    {
+        sjis += "\x81\x5c";
+        utf8 += "\xe2\x80\x95";
+    }
+
+    // only a bare Shift-JIS dash line is a separator, anything else is text
+    auto txt = "a\r\n" + sjis + " b\r\n" + utf8 + "\r\nc\r\n" + sjis + "\r\n" +
+        "d\r\n" + sjis + "\r\n";
+    file->ReadTxt(std::istringstream{txt});
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    CHECK(ss.str() == txt);
+}
+
+TEST_CASE("stsc replace strings", "[Stsc::File]")
+{
+    auto file = MakeSmart<Stsc::File>(ToSource(GenStscStrings(10)));
+    std::vector<std::string> strs;
+    file->ForEachString([&](StringView s) { strs.push_back(s.to_string()); });
+    REQUIRE(strs.size() == 10);
+    CHECK(strs[3] == "line 3\nsecond line");
+
+    auto replace = [&]()
+    {
+        return file->ReplaceStrings([](StringView str, StringView& out)
+        {
+            if (!(str == "line 3\nsecond line")) return false;
+            out = "3\nsecond\nthird";
+            return true;
+        });
+    };
+    CHECK(replace() == 1);
+    CHECK(replace() == 0);
+
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    CHECK(ss.str().find("\r\n3\r\nsecond\r\nthird\r\n\x81\x5c") !=
+          std::string::npos);
+}
+
+TEST_CASE("stsc txt benchmark", "[.][benchmark][Stsc::File]")
+{
+    static constexpr size_t COUNT = 500000;
+    auto buf = GenStscStrings(COUNT);
+    auto t0 = Clock::now();
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+    auto t1 = Clock::now();
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    auto t2 = Clock::now();
+    file->ReadTxt(ss);
+    auto t3 = Clock::now();
+    file->Fixup();
+    auto out = Dump(*file);
+    auto t4 = Clock::now();
+    CHECK(out == buf);
+
+    WARN(COUNT << " strings: parse " << Ms(t1-t0) << " ms, export "
+         << Ms(t2-t1) << " ms, import " << Ms(t3-t2) << " ms, dump "
+         << Ms(t4-t3) << " ms");
+}
+
+TEST_CASE("stsc cfg", "[Stsc::File]")
+{
+    std::string buf{
+        "STSC\x0c\0\0\0\0\0\0\0"
+        "\x0c\x00" "\x0d\x02\x18\0\0\0\x19\0\0\0" // @12: jump table
+        "\x07"                                           // @24
+        "\x06\x18\0\0\0" "\x07"                         // @25: call @24
+        "\x0c\x02\x07", 34};                           // @31: dead code
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+
+    Stsc::Cfg cfg{*file};
+    REQUIRE(cfg.GetInstructions().size() == 5);
+    REQUIRE(cfg.GetBlocks().size() == 4);
+    auto succs = [&](uint32_t b)
+    {
+        auto rng = cfg.GetSuccessors(b);
+        return std::vector<uint32_t>(rng.begin(), rng.end());
+    };
+    CHECK(cfg.GetBlocks()[0].end == 2);
+    CHECK(succs(0) == (std::vector<uint32_t>{1, 2}));
+    CHECK(succs(1).empty());
+    CHECK(succs(2) == (std::vector<uint32_t>{1, 3}));
+    CHECK(succs(3).empty());
+    CHECK(cfg.GetReachable().all());
+
+    std::stringstream ss;
+    cfg.WriteDeadCode(ss);
+    CHECK(ss.str() == "unparsed @31: 3 bytes\n");
+
+    Stsc::InstructionBase::CreateAndInsert(file->GetPointer(31));
+    Stsc::Cfg cfg2{*file};
+    REQUIRE(cfg2.GetBlocks().size() == 5);
+    CHECK(cfg2.GetBlocks()[4].end - cfg2.GetBlocks()[4].begin == 2);
+    CHECK(cfg2.GetReachable().count() == 4);
+    CHECK(!cfg2.GetReachable()[4]);
+    ss.str("");
+    cfg2.WriteDeadCode(ss);
+    CHECK(ss.str() == "unreachable @31: 2 instructions\n");
+
+    ss.str("");
+    cfg2.WriteDot(ss);
+    CHECK(ss.str().find("b4 [label=\"@31 (2)\",style=dashed]") !=
+          std::string::npos);
+    CHECK(ss.str().find("b2 -> b3;") != std::string::npos);
+}
+
+TEST_CASE("stsc snapshot rollback", "[Stsc::File]")
+{
+    std::string buf{"STSC\x0c\0\0\0\0\0\0\0" "\x0e\x12\0\0\0\x07" "foo\0", 22};
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+    file->Fixup();
+
+    std::stringstream ss;
+    file->WriteTxt(ss);
+    auto rest = ss.str().substr(5);
+
+    auto dump = [&]()
+    {
+        file->Fixup();
+        return Dump(*file);
+    };
+
+    auto snap = file->TakeSnapshot();
+    file->ReadTxt(std::istringstream{"barbaz\r\n" + rest});
+    CHECK(dump().size() == buf.size() + 3);
+    file->Rollback(snap);
+    CHECK(dump() == buf);
+
+    // the snapshot can be reused
+    file->ReadTxt(std::istringstream{"x\r\n" + rest});
+    CHECK(dump().size() == buf.size() - 2);
+    file->ReadTxt(std::istringstream{"xyz\r\n" + rest});
+    file->Rollback(snap);
+    CHECK(dump() == buf);
+
+    file->DropSnapshots();
+    file->ReadTxt(std::istringstream{"x\r\n" + rest});
+    CHECK(dump().size() == buf.size() - 2);
+}
+
+TEST_CASE("stsc stats", "[Stsc::File]")
+{
+    std::string buf{"STSC\x0c\0\0\0\0\0\0\0" "\x0e\x12\0\0\0\x07" "foo\0", 22};
+    auto file = MakeSmart<Stsc::File>(ToSource(buf));
+
+    ContextStats stats;
+    stats.Add(*file);
+    CHECK(stats.item_counts[size_t(ItemKind::STSC_HEADER)] == 1);
+    CHECK(stats.item_counts[size_t(ItemKind::STSC_INSTRUCTION)] == 2);
+    CHECK(stats.item_counts[size_t(ItemKind::STSC_STRING)] == 1);
+    CHECK(stats.labels == 2); // entry_point, str_foo
+    CHECK(stats.raw_bytes == 0);
+}
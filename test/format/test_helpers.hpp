@@ -0,0 +1,44 @@
+#ifndef UUID_87338DAD_3B16_4D15_BCB0_A6C9CAE338EF
+#define UUID_87338DAD_3B16_4D15_BCB0_A6C9CAE338EF
+#pragma once
+
+#include "dumpable.hpp"
+#include "sink.hpp"
+#include "source.hpp"
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace Neptools
+{
+namespace Test
+{
+
+inline Source ToSource(const std::string& str)
+{
+    std::unique_ptr<char[]> data{new char[str.size()]};
+    memcpy(data.get(), str.data(), str.size());
+    return Source::FromMemory(std::move(data), str.size());
+}
+
+inline std::string Dump(const Dumpable& dmp)
+{
+    std::string out(dmp.GetSize(), '\0');
+    MemorySink sink(reinterpret_cast<Byte*>(&out[0]), out.size());
+    dmp.Dump(sink);
+    return out;
+}
+
+// timing for the hidden [benchmark] test cases
+using Clock = std::chrono::steady_clock;
+
+inline auto Ms(Clock::duration d)
+{ return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); }
+inline auto Us(Clock::duration d)
+{ return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); }
+
+}
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include "format/translation_memory.hpp"
+#include "sink.hpp"
+#include "test_helpers.hpp"
+#include <catch.hpp>
+#include <cstring>
+#include <sstream>
+
+using namespace Neptools;
+using namespace Neptools::Test;
+
+namespace
+{
+
+// adds "msg 0" ... "msg <count-1>"
+void Fill(TranslationMemory& tm, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        tm.Add("msg " + std::to_string(i));
+}
+
+}
+
+TEST_CASE("translation memory add", "[TranslationMemory]")
+{
+    TranslationMemory tm;
+    Fill(tm, 100);
+    REQUIRE(tm.GetEntries().size() == 100);
+    CHECK(tm.GetEntries()[7].source == "msg 7");
+    CHECK(tm.GetEntries()[7].text == "msg 7");
+    CHECK(tm.GetEntries()[7].hash == TranslationMemory::Hash("msg 7"));
+    CHECK_FALSE(tm.Add("msg 7"));
+    CHECK(tm.Add("msg 100"));
+    REQUIRE(tm.Find("msg 9"));
+    CHECK(*tm.Find("msg 9") == "msg 9");
+    CHECK(tm.Find("msg 101") == nullptr);
+}
+
+TEST_CASE("translation memory txt", "[TranslationMemory]")
+{
+    TranslationMemory tm;
+    Fill(tm, 100);
+
+    // translate through txt, like a translator would
+    std::stringstream ss;
+    tm.WriteTxt(ss);
+    auto txt = ss.str();
+    auto hash = std::to_string(TranslationMemory::Hash("msg 5"));
+    auto pos = txt.find(hash + "\r\nmsg 5\r\n");
+    REQUIRE(pos != std::string::npos);
+    txt.replace(pos + hash.size() + 2, 5, "first\r\nsecond");
+    tm.ReadTxt(std::istringstream{txt});
+    CHECK(*tm.Find("msg 5") == "first\nsecond");
+    CHECK(*tm.Find("msg 6") == "msg 6");
+
+    // unknown hash
+    CHECK_THROWS(tm.ReadTxt(std::istringstream{
+        txt.substr(0, txt.find("\r\n") - 1) + "0\r\nfoo\r\n"}));
+}
+
+TEST_CASE("translation memory table", "[TranslationMemory]")
+{
+    TranslationMemory tm;
+    Fill(tm, 100);
+    CHECK(tm.ReplaceStrings([](StringView str, StringView& out)
+    {
+        if (!(str == "msg 5")) return false;
+        out = "first\nsecond";
+        return true;
+    }) == 1);
+
+    auto dump = Dump(tm);
+    REQUIRE(dump.size() == tm.GetSize());
+    TranslationMemory::Table tbl{ToSource(dump)};
+    CHECK(tbl.GetCount() == 100);
+    StringView out;
+    REQUIRE(tbl.Find("msg 9", out));
+    CHECK(out == "msg 9");
+    REQUIRE(tbl.Find("msg 5", out));
+    CHECK(out == "first\nsecond");
+    CHECK_FALSE(tbl.Find("msg 100", out));
+
+    TranslationMemory tm2{tbl};
+    REQUIRE(tm2.GetEntries().size() == 100);
+    for (size_t i = 0; i < 100; ++i)
+    {
+        CHECK(tm2.GetEntries()[i].hash == tm.GetEntries()[i].hash);
+        CHECK(tm2.GetEntries()[i].source == tm.GetEntries()[i].source);
+        CHECK(tm2.GetEntries()[i].text == tm.GetEntries()[i].text);
+    }
+
+    // a memory is a TxtSerializable too
+    TranslationMemory source;
+    Fill(source, 10);
+    CHECK(tbl.Apply(source) == 1);
+    CHECK(source.GetEntries()[5].text == "first\nsecond");
+    CHECK(tbl.Apply(source) == 0);
+
+    TranslationMemory::Header hdr;
+    memcpy(&hdr, dump.data(), sizeof(hdr));
+    hdr.pool_size = hdr.pool_size + 1;
+    memcpy(&dump[0], &hdr, sizeof(hdr));
+    CHECK_THROWS(TranslationMemory::Table{ToSource(dump)});
+}
+
+TEST_CASE("translation memory hash collision", "[TranslationMemory]")
+{
+    using Slot = TranslationMemory::Slot;
+    TranslationMemory tm;
+    tm.Add("foo");
+    tm.Add("bar");
+    auto dump = Dump(tm);
+
+    // fake a collision: move bar's slot to foo's place with foo's hash, and
+    // foo to the next slot, so lookups of foo have to probe past bar
+    TranslationMemory::Header hdr;
+    memcpy(&hdr, dump.data(), sizeof(hdr));
+    uint32_t mask = hdr.slot_count - 1;
+    auto slots = reinterpret_cast<Slot*>(&dump[sizeof(hdr)]);
+    Slot foo, bar;
+    for (uint32_t i = 0; i <= mask; ++i)
+        if (slots[i].offset != uint32_t(-1))
+            (slots[i].source_offset == 0 ? foo : bar) = slots[i];
+    auto hash = TranslationMemory::Hash("foo");
+    for (uint32_t i = 0; i <= mask; ++i) slots[i].offset = -1;
+    bar.hash = hash;
+    slots[hash & mask] = bar;
+    slots[(hash + 1) & mask] = foo;
+
+    TranslationMemory::Table tbl{ToSource(dump)};
+    StringView out;
+    REQUIRE(tbl.Find("foo", out));
+    CHECK(out == "foo");
+    CHECK_FALSE(tbl.Find("bar", out));
+
+    TranslationMemory tm2{tbl};
+    REQUIRE(tm2.GetEntries().size() == 2);
+    CHECK(tm2.GetEntries()[0].source == "foo");
+    CHECK(tm2.GetEntries()[1].source == "bar");
+    CHECK(tm2.GetEntries()[1].hash == hash);
+    CHECK_FALSE(tm2.Add("foo"));
+    CHECK(*tm2.Find("foo") == "foo");
+
+    // same id twice in the txt, read back in order
+    std::stringstream ss;
+    tm2.WriteTxt(ss);
+    auto txt = ss.str();
+    auto pos = txt.find("\r\nfoo\r\n");
+    REQUIRE(pos != std::string::npos);
+    txt.replace(pos + 2, 3, "1");
+    pos = txt.find("\r\nbar\r\n");
+    REQUIRE(pos != std::string::npos);
+    txt.replace(pos + 2, 3, "2");
+    tm2.ReadTxt(std::istringstream{txt});
+    CHECK(tm2.GetEntries()[0].text == "1");
+    CHECK(tm2.GetEntries()[1].text == "2");
+    CHECK(*tm2.Find("foo") == "1");
+}
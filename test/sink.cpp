@@ -202,6 +202,39 @@ TEST_CASE("sink helpers", "[Sink]")
     REQUIRE(is.eof());
 }
 
+TEST_CASE("sink claim", "[Sink]")
+{
+    static constexpr FilePosition SIZE = 1024*1024;
+    {
+        auto sink = Sink::ToFile("tmp", SIZE, MAYBE);
+        auto ptr = sink->Claim(16);
+        REQUIRE(ptr);
+        for (Byte i = 0; i < 16; ++i) ptr[i] = i;
+        REQUIRE(sink->Tell() == 16);
+
+        // doesn't fit into the window
+        REQUIRE(sink->Claim(SIZE-16) == nullptr);
+        REQUIRE(sink->Tell() == 16);
+        sink->Pad(SIZE-16);
+    }
+
+    char act[17];
+    std::ifstream is{"tmp", std::ios_base::binary};
+    is.read(act, 17);
+    REQUIRE(is.good());
+    for (int i = 0; i < 16; ++i) REQUIRE(act[i] == i);
+    REQUIRE(act[16] == 0);
+}
+
+TEST_CASE("memory claim", "[MemorySink]")
+{
+    Byte buf[16];
+    MemorySink sink{buf, 16};
+    sink.WriteLittleUint32(1);
+    REQUIRE(sink.Claim(12) == buf + 4);
+    REQUIRE(sink.Tell() == 16);
+}
+
 TEST_CASE("memory one write", "[MemorySink]")
 {
     Byte buf[16] = {15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30};
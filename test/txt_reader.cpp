@@ -0,0 +1,81 @@
+#include "txt_reader.hpp"
+#include <catch.hpp>
+#include <fstream>
+#include <sstream>
+
+using namespace Neptools;
+
+namespace
+{
+
+std::string Sep(const char* unit)
+{
+    std::string ret;
+    for (int i = 0; i < 40; ++i) ret += unit;
+    return ret;
+}
+
+}
+
+TEST_CASE("txt reader separators", "[TxtReader]")
+{
+    auto sjis = Sep("\x81\x5c"), utf8 = Sep("\xe2\x80\x95");
+    // long enough for the vectorized search, with almost-separators
+    std::string filler(100, 'x');
+    std::string data = sjis + " 12\r\n" + filler + "\r\n\x81\x5c\r\n" +
+        "line2\r\n" + utf8 + " 13\n" + "\n" + sjis + "\r\n" + "tail";
+
+    TxtReader rd{StringView{data}};
+    StringView body, rest;
+    REQUIRE(rd.Next(body, rest));
+    CHECK(body == "");
+    CHECK(rest == " 12");
+
+    REQUIRE(rd.Next(body, rest));
+    CHECK(body == filler + "\r\n\x81\x5c\r\nline2\r\n");
+    CHECK(rest == " 13");
+
+    REQUIRE(rd.Next(body, rest));
+    CHECK(body == "\n");
+    CHECK(rest == "");
+
+    CHECK_FALSE(rd.Next(body, rest));
+    CHECK(body == "tail");
+    CHECK_FALSE(rd.Next(body, rest));
+    CHECK(body == "");
+}
+
+TEST_CASE("txt reader sources", "[TxtReader]")
+{
+    auto data = "foo\n" + Sep("\x81\x5c") + "\nbar";
+    auto check = [](TxtReader& rd)
+    {
+        StringView body, rest;
+        REQUIRE(rd.Next(body, rest));
+        CHECK(body == "foo\n");
+        CHECK_FALSE(rd.Next(body, rest));
+        CHECK(body == "bar");
+    };
+
+    std::istringstream is{data};
+    TxtReader rd0{is};
+    check(rd0);
+
+    {
+        std::ofstream os{"tmp", std::ios_base::binary};
+        os << data;
+    }
+    TxtReader rd1{boost::filesystem::path{"tmp"}};
+    check(rd1);
+}
+
+TEST_CASE("txt reader normalize", "[TxtReader]")
+{
+    std::string buf;
+    CHECK(TxtReader::Normalize("", "\\n", buf) == "");
+    CHECK(TxtReader::Normalize("abc\n", "\n", buf) == "abc");
+    CHECK(TxtReader::Normalize("abc\r\n", "\n", buf) == "abc");
+    CHECK(TxtReader::Normalize("a\r\nb\nc\r\n", "\n", buf) == "a\nb\nc");
+    CHECK(TxtReader::Normalize("a\r\nb\nc\r\n", "\\n", buf) == "a\\nb\\nc");
+    CHECK(TxtReader::Normalize("a\n\n", "\\n", buf) == "a\\n");
+}
@@ -0,0 +1,55 @@
+#include "txt_writer.hpp"
+#include <catch.hpp>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+using namespace Neptools;
+
+TEST_CASE("txt writer formatting", "[TxtWriter]")
+{
+    std::ostringstream os;
+    {
+        TxtWriter wr{os};
+        wr.WriteUint(0);
+        wr.Write(" ");
+        wr.WriteUint(18446744073709551615ull);
+        wr.Write(" ");
+        wr.WriteUint(1234);
+        wr.Write("|");
+        wr.WriteLines("a\nb\n\nc", "\n");
+        wr.Write("|");
+        wr.WriteLines("a\\nb\\", "\\n");
+        wr.Write("|");
+        wr.WriteLines("\\n\\x", "\\n");
+        wr.Write("|");
+        wr.WriteLines("", "\n");
+        CHECK(os.str() == "");
+    }
+    CHECK(os.str() == "0 18446744073709551615 1234|a\r\nb\r\n\r\nc|"
+          "a\r\nb\\|\r\n\\x|");
+}
+
+TEST_CASE("txt writer large blocks", "[TxtWriter]")
+{
+    // straddle the buffer boundary, and write past its size at once
+    std::string lines, expected;
+    for (size_t i = 0; lines.size() < 3 * TxtWriter::BUF_SIZE; ++i)
+    {
+        lines += "line " + std::to_string(i) + "\n";
+        expected += "line " + std::to_string(i) + "\r\n";
+    }
+    std::string big(TxtWriter::BUF_SIZE + 17, 'x');
+    expected += big;
+
+    {
+        TxtWriter wr{boost::filesystem::path{"tmp"}};
+        wr.WriteLines(lines, "\n");
+        wr.Write(big);
+        wr.Flush();
+    }
+    std::ifstream is{"tmp", std::ios_base::binary};
+    std::string got{std::istreambuf_iterator<char>{is}, {}};
+    CHECK(got.size() == expected.size());
+    CHECK(got == expected);
+}